@@ -0,0 +1,50 @@
+#!/bin/sh
+# Checks --topology, --siblings and --node against the fake machine in tests/fixture:
+# two sockets of two cores with two threads each, NUMA nodes 0 and 1, and a node 2 whose
+# cpulist is corrupt. Usage: tests/topology_test.sh [path/to/z1901330_project1]
+
+program=${1:-./z1901330_project1}
+root=$(dirname "$0")/fixture
+failures=0
+
+# expect NAME EXPECTED_OUTPUT EXPECTED_STATUS ARGS...
+expect() {
+    name=$1
+    expected=$2
+    expectedStatus=$3
+    shift 3
+    actual=$("$program" --sys-root "$root/sys" "$@" 2>&1)
+    status=$?
+    if [ "$actual" != "$expected" ] || [ "$status" -ne "$expectedStatus" ]; then
+        echo "FAIL: $name (status $status)"
+        echo "expected:"
+        echo "$expected"
+        echo "actual:"
+        echo "$actual"
+        failures=$((failures + 1))
+    else
+        echo "ok: $name"
+    fi
+}
+
+expect "topology tree" "Topology: 2 sockets, 4 cores, 8 hardware threads, 3 NUMA nodes
+socket 0: 2 cores
+  core 0: cpus 0,2
+  core 1: cpus 1,3
+socket 1: 2 cores
+  core 0: cpus 4,6
+  core 1: cpus 5,7
+node 0: cpus 0-3
+node 1: cpus 4-7
+node 2: cpus " 0 --topology
+
+expect "siblings" "siblings of cpu 5: 5,7" 0 --siblings 5
+expect "node query" "cpus on node 1: 4-7" 0 --node 1
+expect "corrupt cpulist is rejected" "Error: Unknown NUMA node 2" 1 --node 2
+expect "unknown cpu" "Error: Unknown cpu 8" 1 --siblings 8
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures topology test(s) failed"
+    exit 1
+fi
+echo "All topology tests passed"
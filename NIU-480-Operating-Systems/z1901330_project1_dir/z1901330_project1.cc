@@ -15,20 +15,709 @@ Purpose: Reads and parses various virtual files in the Linux /proc file system t
 #include <string>
 #include <array>
 #include <map>
+#include <bitset>
+#include <chrono>
 #include <sstream>
-#include <limits>
+#include <algorithm>
 #include <cmath>
+#include <vector>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdarg>
+#include <ctime>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
+// Code paths timed by the self-instrumentation
+enum Probe {
+    ProbeSectionA, ProbeSectionB, ProbeSectionC, ProbeSectionD, ProbeSectionE, ProbeSectionF,
+    ProbeParseCpuInfo, ProbeSample, ProbeProcessScan, NumProbes
+};
+
+// HDR-style histogram with 16 linear sub-buckets per power of two, so every recorded value
+// is kept to within 1/16 (about 6%) of its true value at any magnitude
+class LogHistogram {
+public:
+    void record(uint64_t value);
+
+    // Upper bound of the bucket holding the p-th percentile (0 < p <= 100)
+    uint64_t percentile(double p) const;
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maxValue; }
+
+private:
+    static const int SubBucketBits = 4;
+    static const size_t SubBuckets = 1 << SubBucketBits;
+    static const size_t NumBuckets = SubBuckets + (64 - SubBucketBits) * SubBuckets;
+
+    static size_t bucketOf(uint64_t value);
+    static uint64_t bucketUpperBound(size_t bucket);
+
+    uint64_t counts[NumBuckets] = {};
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+};
+
+// Times a probe and counts the open/read/close calls made while it is in scope
+class ScopedProbe {
+public:
+    explicit ScopedProbe(Probe probe);
+    ~ScopedProbe();
+    ScopedProbe(const ScopedProbe&) = delete;
+    ScopedProbe& operator=(const ScopedProbe&) = delete;
+
+private:
+    Probe probe;
+    struct timespec start;
+    uint64_t opensAtStart;
+    uint64_t readsAtStart;
+    uint64_t closesAtStart;
+};
+
+// open/read/close wrappers that feed the self-instrumentation syscall counters
+int instrumentedOpen(const char* path, int flags);
+int instrumentedOpenAt(int dirFd, const char* path, int flags);
+ssize_t instrumentedRead(int fd, void* buf, size_t count);
+ssize_t instrumentedPread(int fd, void* buf, size_t count, off_t offset);
+int instrumentedClose(int fd);
+
+// Print the self-instrumentation report to stderr
+void printSelfStats();
+
+// Install the SIGUSR1 handler that requests a self-instrumentation report
+void installSelfStatsSignal();
+
+// Print the report if SIGUSR1 arrived since the last call
+void serviceSelfStatsRequest();
+
+// Sleep until deadline + intervalNs, advancing deadline; reports requested by SIGUSR1
+// are printed while waiting
+void sleepUntilNextInterval(struct timespec& deadline, long intervalNs);
+
+// A file under /proc that is opened once and then re-read from offset 0 with pread().
+// The buffer only grows while it is too small for the file, so a steady-state refresh
+// makes no heap allocations and no open/close calls.
+class ProcFile {
+public:
+    ProcFile() = default;
+    ~ProcFile();
+    ProcFile(const ProcFile&) = delete;
+    ProcFile& operator=(const ProcFile&) = delete;
+
+    // Open the file and size the buffer with a first read
+    bool open(const std::string& filePath);
+
+    // Re-read the whole file into the buffer, which is always NUL terminated
+    bool refresh();
+
+    const char* data() const { return buffer.data(); }
+    size_t size() const { return length; }
+    const std::string& path() const { return path_; }
+
+private:
+    int fd = -1;
+    std::string path_;
+    std::vector<char> buffer;
+    size_t length = 0;
+};
+
+// Number of distinct /proc/cpuinfo flags tracked in CpuInfo::flags
+const size_t MaxCpuFlags = 128;
+
+// Typed fields of one processor block in /proc/cpuinfo
+struct CpuInfo {
+    int processor = -1;
+    char vendor[16] = "";
+    char modelName[64] = "";
+    int physicalId = -1;
+    int coreId = -1;
+    int siblings = 0;
+    int cpuCores = 0;
+    int physicalAddressBits = 0;
+    int virtualAddressBits = 0;
+    std::bitset<MaxCpuFlags> flags;
+};
+
+// Cumulative tick counters from one cpuN line of /proc/stat
+struct CpuTimes {
+    uint64_t user = 0;
+    uint64_t nice = 0;
+    uint64_t system = 0;
+    uint64_t idle = 0;
+};
+
+// Tick counters of every cpuN line in /proc/stat, one array per field so the
+// delta kernel walks contiguous memory
+struct CpuStatSnapshot {
+    size_t numCpus = 0;
+    std::vector<uint32_t> cpuIds;
+    std::vector<uint64_t> user;
+    std::vector<uint64_t> nice;
+    std::vector<uint64_t> system;
+    std::vector<uint64_t> idle;
+    std::vector<uint64_t> iowait;
+    std::vector<uint64_t> irq;
+    std::vector<uint64_t> softirq;
+    std::vector<uint64_t> steal;
+
+    // Resize every array; only allocates when the CPU count grows
+    void resize(size_t count);
+};
+
+// Per-interval utilization percentages for every processor in a snapshot
+struct CpuUtilization {
+    size_t numCpus = 0;
+    std::vector<float> busy;
+    std::vector<float> user;
+    std::vector<float> system;
+    std::vector<float> iowait;
+    std::vector<float> steal;
+
+    // Resize every array; only allocates when the CPU count grows
+    void resize(size_t count);
+};
+
+// Totals over every swap area in /proc/swaps, in KB
+struct SwapTotals {
+    int numDevices = 0;
+    uint64_t sizeKb = 0;
+    uint64_t usedKb = 0;
+};
+
+// Fields of /proc/meminfo, in KB
+struct MemInfo {
+    uint64_t memTotal = 0;
+    uint64_t memFree = 0;
+    uint64_t memAvailable = 0;
+    uint64_t buffers = 0;
+    uint64_t cached = 0;
+    uint64_t dirty = 0;
+    uint64_t swapTotal = 0;
+    uint64_t swapFree = 0;
+};
+
+// Cumulative event counters from /proc/vmstat
+struct VmStat {
+    uint64_t pgfault = 0;
+    uint64_t pgmajfault = 0;
+    uint64_t pswpin = 0;
+    uint64_t pswpout = 0;
+};
+
+// One "some" or "full" line of a /proc/pressure file
+struct PressureLine {
+    double avg10 = 0.0;
+    double avg60 = 0.0;
+    double avg300 = 0.0;
+    uint64_t totalUs = 0;
+};
+
+// One /proc/pressure file; "full" is missing from pressure/cpu on older kernels
+struct Pressure {
+    PressureLine some;
+    PressureLine full;
+    bool hasFull = false;
+};
+
+// Everything the memory pressure section reads in one sample
+struct MemorySample {
+    SwapTotals swap;
+    MemInfo meminfo;
+    VmStat vmstat;
+    bool hasPressure = false;
+    Pressure cpu;
+    Pressure memory;
+    Pressure io;
+};
+
+// Per-second rates between two memory samples. Stall values are the percentage of
+// wall time that some/all tasks were stalled, from the PSI total counters.
+struct MemoryRates {
+    double pgfault = 0.0;
+    double pgmajfault = 0.0;
+    double pswpin = 0.0;
+    double pswpout = 0.0;
+    double cpuSomeStall = 0.0;
+    double memorySomeStall = 0.0;
+    double memoryFullStall = 0.0;
+    double ioSomeStall = 0.0;
+    double ioFullStall = 0.0;
+};
+
+// One sample of the values that change while the system is running
+struct Sample {
+    uint64_t timestampNs = 0;
+    double uptimeSeconds = 0.0;
+    bool hasCpu5 = false;
+    CpuTimes cpu5;
+    bool hasSwap = false;
+    double swapSizeMb = 0.0;
+    CpuStatSnapshot cpuStat;
+    CpuUtilization utilization;
+    bool hasMemory = false;
+    MemorySample memory;
+    MemoryRates memoryRates;
+};
+
+// A byte buffer that one sample is formatted into and then written with a single write(2).
+// Like ProcFile, it only grows while it is too small, so steady-state samples do not allocate.
+class OutputBuffer {
+public:
+    OutputBuffer() : buffer(16384) {}
+
+    void append(const void* data, size_t size);
+
+    // printf-style append
+    void appendf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    // Write the whole buffer to fd and empty it
+    bool flushTo(int fd);
+
+private:
+    void reserve(size_t extra);
+
+    std::vector<char> buffer;
+    size_t length = 0;
+};
+
+// Output formats selected with --format
+enum class OutputFormat { Text, JsonLines, Binary };
+
+// Serializes samples into an OutputBuffer in one output format
+class OutputSink {
+public:
+    explicit OutputSink(bool perCpu) : perCpu(perCpu) {}
+    virtual ~OutputSink() = default;
+
+    virtual void writeSample(long sampleNumber, const Sample& sample, OutputBuffer& out) = 0;
+
+protected:
+    bool perCpu;
+};
+
+// Human-readable text, one line per sample plus one line per processor
+class TextSink : public OutputSink {
+public:
+    using OutputSink::OutputSink;
+    void writeSample(long sampleNumber, const Sample& sample, OutputBuffer& out) override;
+};
+
+// One JSON object per line
+class JsonLinesSink : public OutputSink {
+public:
+    using OutputSink::OutputSink;
+    void writeSample(long sampleNumber, const Sample& sample, OutputBuffer& out) override;
+};
+
+// Fixed-layout binary records: a BinarySampleHeader followed by numCpus BinaryCpuRecords,
+// in host byte order
+class BinarySink : public OutputSink {
+public:
+    using OutputSink::OutputSink;
+    void writeSample(long sampleNumber, const Sample& sample, OutputBuffer& out) override;
+};
+
+// Header of one binary sample record
+struct BinarySampleHeader {
+    uint32_t magic;          // BinarySampleMagic
+    uint16_t version;        // BinarySampleVersion
+    uint16_t headerSize;     // sizeof(BinarySampleHeader)
+    uint64_t sampleNumber;
+    uint64_t timestampNs;    // CLOCK_REALTIME when the sample was taken
+    double uptimeSeconds;
+    double swapSizeMb;
+    uint64_t cpu5User;       // cumulative ticks
+    uint64_t cpu5Nice;
+    uint64_t cpu5System;
+    uint64_t cpu5Idle;
+    uint32_t flags;          // BinaryHasCpu5 | BinaryHasSwap | BinaryHasMemory
+    uint32_t numCpus;        // number of BinaryCpuRecords that follow
+};
+
+// Memory pressure of one binary sample record, present between the header and the
+// BinaryCpuRecords when BinaryHasMemory is set
+struct BinaryMemoryRecord {
+    uint64_t memTotalKb;
+    uint64_t memAvailableKb;
+    uint64_t swapSizeKb;
+    uint64_t swapUsedKb;
+    double pgfaultPerSecond;
+    double pgmajfaultPerSecond;
+    double pswpinPerSecond;
+    double pswpoutPerSecond;
+    double cpuSomeStall;
+    double memorySomeStall;
+    double memoryFullStall;
+    double ioSomeStall;
+    double ioFullStall;
+};
+
+// Utilization of one processor in a binary sample record
+struct BinaryCpuRecord {
+    uint32_t cpuId;
+    float busy;
+    float user;
+    float system;
+    float iowait;
+    float steal;
+};
+
+const uint32_t BinarySampleMagic = 0x52533150;  // "P1SR"
+const uint16_t BinarySampleVersion = 2;
+const uint32_t BinaryHasCpu5 = 1u << 0;
+const uint32_t BinaryHasSwap = 1u << 1;
+const uint32_t BinaryHasMemory = 1u << 2;
+static_assert(sizeof(BinarySampleHeader) == 80, "binary sample header layout changed");
+static_assert(sizeof(BinaryMemoryRecord) == 104, "binary memory record layout changed");
+static_assert(sizeof(BinaryCpuRecord) == 24, "binary cpu record layout changed");
+
+// Socket -> core -> hardware thread tree of the machine, plus NUMA node membership,
+// built from /proc/cpuinfo and the topology files under /sys/devices/system
+class Topology {
+public:
+    // Build the tree for the processors in cpus; sysRoot is normally "/sys"
+    void build(const std::vector<CpuInfo>& cpus, const std::string& sysRoot);
+
+    size_t numSockets() const { return sockets.size(); }
+    size_t numCores() const;
+    size_t numThreads() const { return threads.size(); }
+    size_t numNodes() const { return nodes.size(); }
+
+    // Number of sockets that have more than one core
+    size_t numMultiCoreSockets() const;
+
+    // Hardware threads that share a core with cpu, including cpu itself
+    std::vector<int> siblingsOf(int cpu) const;
+
+    // Processors on NUMA node
+    std::vector<int> cpusOnNode(int node) const;
+
+    // NUMA node of cpu, or -1 if unknown
+    int nodeOf(int cpu) const;
+
+    // Print the tree and the NUMA nodes
+    void print(std::ostream& out) const;
+
+private:
+    struct HardwareThread {
+        int cpu;
+        int socketId;
+        int coreId;
+        int node;
+    };
+    struct Core {
+        int coreId;
+        std::vector<int> cpus;
+    };
+    struct Socket {
+        int socketId;
+        std::vector<Core> cores;
+    };
+
+    const HardwareThread* findThread(int cpu) const;
+
+    std::vector<HardwareThread> threads;       // sorted by cpu
+    std::vector<Socket> sockets;               // sorted by socket id, then core id
+    std::map<int, std::vector<int>> nodes;     // node -> sorted cpus
+};
+
+// The files re-read on every sample in --interval mode
+struct SampleFiles {
+    ProcFile uptime;
+    ProcFile stat;
+    ProcFile swaps;
+
+    // Only opened with --memory; the pressure files only if the kernel has PSI
+    bool withMemory = false;
+    bool withPressure = false;
+    ProcFile meminfo;
+    ProcFile vmstat;
+    ProcFile pressureCpu;
+    ProcFile pressureMemory;
+    ProcFile pressureIo;
+};
+
+// Options of --interval mode
+struct SamplingOptions {
+    double intervalSeconds = 0.0;
+    long count = 0;
+    bool perCpu = false;
+    bool memory = false;
+    OutputFormat format = OutputFormat::Text;
+    int topN = 0;
+    int scanThreads = 0;
+    std::string servePath;
+    size_t historySize = 600;
+};
+
+// Fixed-size fields of one sample kept in a SampleRing
+struct RingRecord {
+    uint64_t sampleNumber;
+    uint64_t timestampNs;
+    double uptimeSeconds;
+    bool hasSwap;
+    double swapSizeMb;
+    bool hasCpu5;
+    CpuTimes cpu5;
+    uint32_t numCpus;  // utilization entries stored for this sample
+};
+
+// The last N samples in a fixed-size single-producer/multi-consumer ring. Each slot is a
+// seqlock: the sampler makes its sequence odd, writes, then publishes an even sequence, and
+// never waits for readers. Readers copy a slot and retry if the sequence moved, so they never
+// write shared memory and cannot block the sampler.
+class SampleRing {
+public:
+    SampleRing(size_t capacity, size_t maxCpus);
+
+    // Publish the next sample; only the sampler thread may call this
+    void publish(long sampleNumber, const Sample& sample);
+
+    // Number of samples published so far
+    uint64_t published() const { return head.load(std::memory_order_acquire); }
+
+    // Copy the index-th published sample (0-based) and up to maxCpus() utilization entries.
+    // Returns false if it has not been published yet or was already overwritten.
+    bool read(uint64_t index, RingRecord& record, uint32_t* cpuIds, float* busy) const;
+
+    size_t capacity() const { return numSlots; }
+    size_t maxCpus() const { return cpusPerSlot; }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        RingRecord record;
+    };
+
+    size_t numSlots;
+    size_t cpusPerSlot;
+    std::unique_ptr<Slot[]> slots;
+    std::vector<uint32_t> cpuIds;  // numSlots * cpusPerSlot
+    std::vector<float> busy;       // numSlots * cpusPerSlot
+
+    // Keep the head, which every reader polls, off the cache line of the fields above
+    char padding[64];
+    std::atomic<uint64_t> head{0};
+};
+
+// Answers queries about the samples in a SampleRing on a Unix domain socket, from its own
+// thread, one line-oriented request per connection
+class QueryServer {
+public:
+    QueryServer(const SampleRing& ring, const std::string& socketPath);
+    ~QueryServer();
+
+    // Bind the socket and start the server thread
+    bool start();
+
+private:
+    void serve();
+    void handleClient(int clientFd);
+    void answer(const char* request, OutputBuffer& out);
+
+    const SampleRing& ring;
+    std::string socketPath;
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    // Scratch space for reading one slot, owned by the server thread
+    std::vector<uint32_t> cpuIds;
+    std::vector<float> busy;
+};
+
+// One process as read from /proc/[pid]/stat and /proc/[pid]/statm
+struct ProcessRecord {
+    int pid = 0;
+    char state = '?';
+    char comm[17] = "";
+    uint64_t cpuTicks = 0;   // utime + stime
+    uint64_t startTime = 0;  // in ticks since boot, to tell a reused pid from the old process
+    uint64_t rssPages = 0;
+    float cpuPercent = 0.0f;
+    bool valid = false;
+};
+
+// Open-addressing hash table (linear probing) from pid to the CPU ticks seen in the previous
+// scan. Entries of processes that were not seen in a scan become tombstones, and the table is
+// rebuilt when tombstones and live entries fill half of it.
+class PidTable {
+public:
+    struct Entry {
+        int pid;                // EmptyPid, TombstonePid or a real pid
+        uint32_t generation;    // scan in which the entry was last seen
+        uint64_t startTime;
+        uint64_t cpuTicks;
+    };
+
+    PidTable() : slots(1024, Entry{EmptyPid, 0, 0, 0}) {}
+
+    // Find the entry for pid, inserting an empty one if it is missing
+    Entry& findOrInsert(int pid, bool& inserted);
+
+    // Turn the entries not seen in generation into tombstones
+    void sweep(uint32_t generation);
+
+    size_t size() const { return live; }
+
+private:
+    static const int EmptyPid = 0;
+    static const int TombstonePid = -1;
+
+    void rehash(size_t capacity);
+
+    std::vector<Entry> slots;
+    size_t live = 0;
+    size_t tombstones = 0;
+};
+
+// A small persistent thread pool that splits [0, count) into chunks handed out through an
+// atomic counter. The calling thread works too, and run() returns once every chunk is done.
+class ScanPool {
+public:
+    explicit ScanPool(int numThreads);
+    ~ScanPool();
+    ScanPool(const ScanPool&) = delete;
+    ScanPool& operator=(const ScanPool&) = delete;
+
+    // Call task(context, begin, end) for every chunk of [0, count)
+    void run(size_t count, void (*task)(void*, size_t, size_t), void* context);
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+private:
+    static const size_t ChunkSize = 128;
+
+    void workerLoop();
+    void drain();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t round = 0;
+    int busyWorkers = 0;
+    bool stopping = false;
+
+    void (*task)(void*, size_t, size_t) = nullptr;
+    void* context = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> nextIndex{0};
+};
+
 // Function to read and print the contents of a file
 void readAndPrintFile(const std::string& filePath);
 
-// Parse information from /proc/cpuinfo into an array of maps
-std::array<std::map<std::string, std::string>, 8> parseCpuInfo();
+// Parse information from /proc/cpuinfo into one entry per processor
+std::vector<CpuInfo> parseCpuInfo();
+
+// Parse the text of /proc/cpuinfo into cpus, reusing its storage when the CPU count is unchanged
+void parseCpuInfoBuffer(const char* text, size_t length, std::vector<CpuInfo>& cpus);
+
+// Return the bit index of a cpuinfo flag name, or -1 if it is not tracked
+int lookupCpuFlag(const char* name, size_t length);
+
+// Return the name of a tracked cpuinfo flag bit
+const char* cpuFlagName(size_t index);
+
+// Parse a sysfs cpu list such as "0-3,8-11" into cpu numbers
+std::vector<int> parseCpuList(const char* text);
+
+// Format cpu numbers as a sysfs-style cpu list such as "0-3,8-11"
+std::string formatCpuList(const std::vector<int>& cpus);
+
+// Build the path of a file under the proc root, e.g. procPath("stat")
+std::string procPath(const char* relativePath);
+
+// Return the proc directory that sits beside a sys root, used when only --sys-root is given
+std::string siblingProcRoot(const std::string& sysRootPath);
+
+// Record count snapshots of the /proc files used by sections A-E into one capture file
+int runCaptureMode(const std::string& capturePath, double intervalSeconds, long count);
+
+// Replay a capture file through the parsers of sections A-E and report parse ns/op
+int runReplayMode(const std::string& capturePath, long iterations);
+
+// Print the topology, or answer a siblings/node query if one is given
+int runTopologyMode(const std::string& sysRoot, int siblingsCpu, int node);
+
+// Compare the cpuinfo parser against the original map-of-strings parser
+int runCpuInfoBenchmark(int numCpus, int iterations);
 
 // Convert seconds into a formatted time string
 std::string convertSecondsToTimeString(double seconds);
 
+// Format seconds like convertSecondsToTimeString, but into a caller-provided buffer
+void formatSecondsToTimeString(double seconds, char* out, size_t outSize);
+
+// Find the line in a buffer that starts with the given prefix, or return nullptr
+const char* findLine(const char* text, const char* prefix);
+
+// Parse the first field of /proc/uptime
+bool parseUptime(const char* text, double& uptimeSeconds);
+
+// Parse the user, nice, system and idle ticks of one cpuN line of /proc/stat
+bool parseCpuTimes(const char* text, const char* cpuName, CpuTimes& times);
+
+// Parse every cpuN line of /proc/stat into a snapshot
+bool parseCpuStatSnapshot(const char* text, CpuStatSnapshot& snapshot);
+
+// Compute utilization percentages between two snapshots of the same processors
+void computeCpuUtilization(const CpuStatSnapshot& previous, const CpuStatSnapshot& current,
+                           CpuUtilization& utilization);
+
+// Sum the size and usage of every swap area in /proc/swaps
+bool parseSwapTotals(const char* text, SwapTotals& totals);
+
+// Parse the fields of /proc/meminfo used by the memory pressure section
+bool parseMemInfo(const char* text, MemInfo& meminfo);
+
+// Parse the fault and swap counters of /proc/vmstat
+bool parseVmStat(const char* text, VmStat& vmstat);
+
+// Parse one /proc/pressure file
+bool parsePressure(const char* text, Pressure& pressure);
+
+// Compute per-second rates between two memory samples taken elapsedSeconds apart
+void computeMemoryRates(const MemorySample& previous, const MemorySample& current, double elapsedSeconds,
+                        MemoryRates& rates);
+
+// Re-read the sample files and parse them into a sample
+bool collectSample(SampleFiles& files, Sample& sample);
+
+// Create the sink for an output format
+std::unique_ptr<OutputSink> makeOutputSink(OutputFormat format, bool perCpu);
+
+// Sample uptime, processor 5 and swap every interval, count times (0 = forever), adding the
+// utilization of every processor and memory pressure if requested, and write them to stdout
+int runSamplingMode(const SamplingOptions& options);
+
+// Read /proc/[pid]/stat and /proc/[pid]/statm relative to an open /proc directory
+bool readProcess(int procFd, int pid, ProcessRecord& record);
+
+// Print the top-N processes by CPU and by RSS every interval, count times (0 = forever)
+int runProcessMode(const SamplingOptions& options);
+
+// Send one request to a --serve socket and print the answer
+int runQueryClient(const std::string& socketPath, const std::string& request);
+
 // Print questions from section A
 void printSectionA();
 
@@ -44,10 +733,145 @@ void printSectionD();
 // Print questions from section E
 void printSectionE();
 
-// Initialize and populate an array of maps with CPU information
-std::array<std::map<std::string, std::string>, 8> parsedCpuInfo = parseCpuInfo();
+// Print memory pressure from section F
+void printSectionF();
+
+// Roots of the proc and sys file systems, changed with --proc-root and --sys-root
+std::string procRoot = "/proc";
+std::string sysRoot = "/sys";
+
+// CPU information, populated once the command line has been parsed
+std::vector<CpuInfo> parsedCpuInfo;
+
+// Print the self-instrumentation report at exit, set by --self-stats
+bool selfStatsAtExit = false;
+
+// Print the self-instrumentation report at exit if requested, and pass status through
+static int finish(int status) {
+    if (selfStatsAtExit) {
+        printSelfStats();
+    }
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    SamplingOptions options;
+    double& intervalSeconds = options.intervalSeconds;
+    long& count = options.count;
+    OutputFormat& format = options.format;
+    bool topologyMode = false;
+    int siblingsCpu = -1;
+    int node = -1;
+    std::string capturePath;
+    std::string replayPath;
+    long iterations = 100;
+    bool sysRootGiven = false;
+    bool procRootGiven = false;
+
+    // Parse the command line options
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            intervalSeconds = strtod(argv[++i], nullptr);
+            if (intervalSeconds <= 0.0) {
+                std::cerr << "Error: --interval must be a positive number of seconds" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = strtol(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--per-cpu") == 0) {
+            options.perCpu = true;
+        } else if (strcmp(argv[i], "--memory") == 0) {
+            options.memory = true;
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            options.topN = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.scanThreads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            options.servePath = argv[++i];
+        } else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            options.historySize = std::max(1L, strtol(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--query") == 0 && i + 2 < argc) {
+            std::string socketPath = argv[++i];
+            return runQueryClient(socketPath, argv[++i]);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (strcmp(name, "text") == 0) {
+                format = OutputFormat::Text;
+            } else if (strcmp(name, "json") == 0) {
+                format = OutputFormat::JsonLines;
+            } else if (strcmp(name, "binary") == 0) {
+                format = OutputFormat::Binary;
+            } else {
+                std::cerr << "Error: --format must be text, json or binary" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--topology") == 0) {
+            topologyMode = true;
+        } else if (strcmp(argv[i], "--siblings") == 0 && i + 1 < argc) {
+            topologyMode = true;
+            siblingsCpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--node") == 0 && i + 1 < argc) {
+            topologyMode = true;
+            node = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sys-root") == 0 && i + 1 < argc) {
+            sysRoot = argv[++i];
+            sysRootGiven = true;
+        } else if (strcmp(argv[i], "--proc-root") == 0 && i + 1 < argc) {
+            procRoot = argv[++i];
+            procRootGiven = true;
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capturePath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = std::max(1L, strtol(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--self-stats") == 0) {
+            selfStatsAtExit = true;
+        } else if (strcmp(argv[i], "--bench-cpuinfo") == 0) {
+            return runCpuInfoBenchmark(256, 200);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--interval SECONDS [--count N] [--per-cpu] [--memory] [--format text|json|binary]"
+                      << " [--serve SOCKET [--history N]]] [--query SOCKET REQUEST]"
+                      << " [--top N [--threads N]] [--topology | --siblings CPU | --node NODE] [--capture FILE] [--replay FILE [--iterations N]]"
+                      << " [--proc-root DIR] [--sys-root DIR] [--self-stats] [--bench-cpuinfo]" << std::endl;
+            return 1;
+        }
+    }
+
+    // A fake sys root brings its own proc next to it, so that cpuinfo and sysfs describe the same machine
+    if (sysRootGiven && !procRootGiven) {
+        procRoot = siblingProcRoot(sysRoot);
+    }
+
+    if (!replayPath.empty()) {
+        return runReplayMode(replayPath, iterations);
+    }
+    if (!capturePath.empty()) {
+        // Default to ten one-second snapshots
+        return runCaptureMode(capturePath, intervalSeconds > 0.0 ? intervalSeconds : 1.0, count > 0 ? count : 10);
+    }
+
+    installSelfStatsSignal();
+    parsedCpuInfo = parseCpuInfo();
+
+    if (topologyMode) {
+        return finish(runTopologyMode(sysRoot, siblingsCpu, node));
+    }
+    if (options.topN > 0) {
+        // Like top, default to one-second updates until interrupted
+        if (intervalSeconds <= 0.0) {
+            intervalSeconds = 1.0;
+        }
+        return finish(runProcessMode(options));
+    }
+    if (intervalSeconds > 0.0) {
+        return finish(runSamplingMode(options));
+    }
+    if (format != OutputFormat::Text) {
+        std::cerr << "Error: --format requires --interval" << std::endl;
+        return 1;
+    }
 
-int main() {
     std::cout << "A: Questions about OS:" << std::endl;
     printSectionA();
 
@@ -63,16 +887,21 @@ int main() {
     std::cout << "E: Size of swap device in MB: ";
     printSectionE();
 
-    return 0;
+    std::cout << "F: Memory pressure:" << std::endl;
+    printSectionF();
+
+    std::cout.flush();
+    return finish(0);
 }
 
 // Function to print information about the OS
 void printSectionA() {
     // SECTION A ------------------------
-    std::string ostypeFilePath = "/proc/sys/kernel/ostype";
-    std::string hostnameFilePath = "/proc/sys/kernel/hostname";
-    std::string osreleaseFilePath = "/proc/sys/kernel/osrelease";
-    std::string versionFilePath = "/proc/sys/kernel/version";
+    ScopedProbe probe(ProbeSectionA);
+    std::string ostypeFilePath = procPath("sys/kernel/ostype");
+    std::string hostnameFilePath = procPath("sys/kernel/hostname");
+    std::string osreleaseFilePath = procPath("sys/kernel/osrelease");
+    std::string versionFilePath = procPath("sys/kernel/version");
 
     // Read and print the contents of each file
     std::cout << "1. ostype: ";
@@ -90,36 +919,25 @@ void printSectionA() {
 // Function to print information about processors
 void printSectionB() {
     // SECTION B ------------------------
-    std::string uptimeFilePath = "/proc/uptime";
+    ScopedProbe probe(ProbeSectionB);
+    std::string uptimeFilePath = procPath("uptime");
 
     // Accessing and printing the data
     // Question 1. Number of processors
     std::cout << "1. num of processors: " << parsedCpuInfo.size() << std::endl;
 
-    // Question 2. Number of multi-core chips
-    int count = 0;
-    for (const auto& cpuInfoMap : parsedCpuInfo) {
-        auto physicalIdIter = cpuInfoMap.find("physical id");
-        if (physicalIdIter != cpuInfoMap.end() && physicalIdIter->second == "1") {
-            count++;
-        }
-    }
-    std::cout << "2. num of physical multi-core chips: " << count << std::endl;
+    // Question 2. Number of multi-core chips, i.e. sockets with more than one core
+    Topology topology;
+    topology.build(parsedCpuInfo, sysRoot);
+    std::cout << "2. num of physical multi-core chips: " << topology.numMultiCoreSockets() << std::endl;
 
     // Question 3. Uptime in seconds
     // Get uptime from /proc/uptime
-    std::ifstream file(uptimeFilePath);
-    std::string line;
-
-    // Get the first line from /proc/uptime
-    std::getline(file, line);
-
-    // Reading the formatted data into uptimeInSeconds
-    std::istringstream iss(line);
-    double uptimeInSeconds;
+    ProcFile file;
+    double uptimeInSeconds = 0.0;
 
     // If the file isn't empty, read it into uptimeInSeconds and print it
-    if (iss >> uptimeInSeconds) {
+    if (file.open(uptimeFilePath) && parseUptime(file.data(), uptimeInSeconds)) {
         std::cout << std::fixed << std::setprecision(2) << "3. uptime in seconds: " << uptimeInSeconds << std::endl;
     } else {
         std::cerr << "Failed to extract seconds." << std::endl;
@@ -134,6 +952,13 @@ void printSectionB() {
 
 // Function to convert seconds into a formatted time string
 std::string convertSecondsToTimeString(double seconds) {
+    char formattedTime[128];
+    formatSecondsToTimeString(seconds, formattedTime, sizeof(formattedTime));
+    return formattedTime;
+}
+
+// Function to format seconds into a caller-provided buffer without allocating
+void formatSecondsToTimeString(double seconds, char* out, size_t outSize) {
     double remainingSeconds = fmod(seconds, 60.0);
     double totalMinutes = (seconds - remainingSeconds) / 60.0;
     double minutes = fmod(totalMinutes, 60.0);
@@ -141,93 +966,375 @@ std::string convertSecondsToTimeString(double seconds) {
     double hours = fmod(totalHours, 24.0);
     double days = (totalHours - hours) / 24.0;
 
-    std::ostringstream formattedTime;
-    formattedTime << std::fixed << std::setprecision(0);
+    size_t used = 0;
+    auto append = [&](const char* format, double value) {
+        if (used < outSize) {
+            int written = snprintf(out + used, outSize - used, format, value);
+            if (written > 0) {
+                used += static_cast<size_t>(written);
+            }
+        }
+    };
+
+    out[0] = '\0';
     if (days > 0) {
-        formattedTime << days << " days, ";
+        append("%.0f days, ", days);
     }
     if (hours > 0) {
-        formattedTime << hours << " hours, ";
+        append("%.0f hours, ", hours);
     }
     if (minutes > 0) {
-        formattedTime << minutes << " minutes, ";
+        append("%.0f minutes, ", minutes);
     }
-    formattedTime << remainingSeconds << " seconds";
-
-    return formattedTime.str();
+    append("%.0f seconds", remainingSeconds);
 }
 
-// Function to parse information from /proc/cpuinfo into an array of maps
-std::array<std::map<std::string, std::string>, 8> parseCpuInfo() {
+// Function to parse information from /proc/cpuinfo into one entry per processor
+std::vector<CpuInfo> parseCpuInfo() {
+    ScopedProbe probe(ProbeParseCpuInfo);
     // SECTION B -------------------------
-    std::string cpuinfoFilePath = "/proc/cpuinfo";
-    std::ifstream file(cpuinfoFilePath);
+    std::vector<CpuInfo> cpus;
+    ProcFile file;
+    if (!file.open(procPath("cpuinfo"))) {
+        return cpus;
+    }
 
     // -----------------------------------
-    std::array<std::map<std::string, std::string>, 8> arrayOfCpuInfo;
-    if (!file.is_open()) {
-        std::cerr << "Error: Failed to open file /proc/cpuinfo" << std::endl;
-        return arrayOfCpuInfo;
+    parseCpuInfoBuffer(file.data(), file.size(), cpus);
+    return cpus;
+}
+
+// Flag names tracked in CpuInfo::flags; anything else on the flags line is ignored
+static const char* const cpuFlagNames[] = {
+    // x86
+    "fpu", "vme", "de", "pse", "tsc", "msr", "pae", "mce", "cx8", "apic", "sep", "mtrr",
+    "pge", "mca", "cmov", "pat", "pse36", "clflush", "mmx", "fxsr", "sse", "sse2", "ss", "ht",
+    "tm", "syscall", "nx", "pdpe1gb", "rdtscp", "lm", "constant_tsc", "nonstop_tsc", "pni",
+    "pclmulqdq", "vmx", "svm", "ssse3", "fma", "cx16", "pcid", "sse4_1", "sse4_2", "x2apic",
+    "movbe", "popcnt", "aes", "xsave", "avx", "f16c", "rdrand", "hypervisor", "lahf_lm",
+    "abm", "sse4a", "fsgsbase", "bmi1", "hle", "avx2", "smep", "bmi2", "erms", "invpcid",
+    "rtm", "avx512f", "avx512dq", "rdseed", "adx", "smap", "avx512ifma", "clflushopt", "clwb",
+    "avx512cd", "sha_ni", "avx512bw", "avx512vl", "xsaveopt", "xsavec", "xsaves", "avx_vnni",
+    "avx512_bf16", "umip", "pku", "avx512vbmi", "avx512_vbmi2", "gfni", "vaes", "vpclmulqdq",
+    "avx512_vnni", "avx512_bitalg", "avx512_vpopcntdq", "rdpid", "movdiri", "movdir64b",
+    "fsrm", "serialize", "amx_bf16", "avx512_fp16", "amx_tile", "amx_int8", "md_clear",
+    // arm64 (the "Features" line)
+    "fp", "asimd", "evtstrm", "pmull", "sha1", "sha2", "crc32", "atomics", "fphp", "asimdhp",
+    "cpuid", "asimdrdm", "lrcpc", "dcpop", "asimddp", "sha3", "sm3", "sm4", "sha512", "sve",
+    "sve2", "bf16", "i8mm"
+};
+static const size_t numCpuFlagNames = sizeof(cpuFlagNames) / sizeof(cpuFlagNames[0]);
+static_assert(sizeof(cpuFlagNames) / sizeof(cpuFlagNames[0]) <= MaxCpuFlags, "too many cpuinfo flags");
+
+// Open-addressing table from an FNV-1a hash of a flag name to its bit index, built once
+struct CpuFlagTable {
+    static const size_t Slots = 512;
+    int16_t slots[Slots];
+
+    static uint32_t hash(const char* name, size_t length) {
+        uint32_t value = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            value = (value ^ static_cast<unsigned char>(name[i])) * 16777619u;
+        }
+        return value;
     }
 
-    // -----------------------------------
+    CpuFlagTable() {
+        std::fill(slots, slots + Slots, static_cast<int16_t>(-1));
+        for (size_t index = 0; index < numCpuFlagNames; ++index) {
+            size_t slot = hash(cpuFlagNames[index], strlen(cpuFlagNames[index])) % Slots;
+            while (slots[slot] != -1) {
+                slot = (slot + 1) % Slots;
+            }
+            slots[slot] = static_cast<int16_t>(index);
+        }
+    }
+};
+
+// Function to look up the bit index of a cpuinfo flag
+int lookupCpuFlag(const char* name, size_t length) {
+    static const CpuFlagTable table;
+    size_t slot = CpuFlagTable::hash(name, length) % CpuFlagTable::Slots;
+    while (table.slots[slot] != -1) {
+        const char* candidate = cpuFlagNames[table.slots[slot]];
+        if (strncmp(candidate, name, length) == 0 && candidate[length] == '\0') {
+            return table.slots[slot];
+        }
+        slot = (slot + 1) % CpuFlagTable::Slots;
+    }
+    return -1;
+}
+
+// Function to return the name of a tracked cpuinfo flag
+const char* cpuFlagName(size_t index) {
+    return index < numCpuFlagNames ? cpuFlagNames[index] : "";
+}
+
+// Compare a trimmed key against a literal without copying it
+static bool keyEquals(const char* key, size_t keyLength, const char* literal) {
+    return strncmp(key, literal, keyLength) == 0 && literal[keyLength] == '\0';
+}
+
+// Copy a value into a fixed-size field, truncating if needed
+static void copyField(char* field, size_t fieldSize, const char* value, size_t valueLength) {
+    size_t copied = std::min(valueLength, fieldSize - 1);
+    memcpy(field, value, copied);
+    field[copied] = '\0';
+}
+
+// Parse a decimal integer out of a value that is not NUL terminated at its end
+static int parseIntField(const char* value, size_t valueLength) {
+    int result = 0;
+    for (size_t i = 0; i < valueLength && isdigit(static_cast<unsigned char>(value[i])); ++i) {
+        result = result * 10 + (value[i] - '0');
+    }
+    return result;
+}
+
+// Function to parse the text of /proc/cpuinfo into typed per-processor entries
+void parseCpuInfoBuffer(const char* text, size_t length, std::vector<CpuInfo>& cpus) {
+    const char* const textEnd = text + length;
+
+    // Count the processors first so the vector is sized to the real CPU count
+    size_t numProcessors = 0;
+    for (const char* line = text; line < textEnd;) {
+        const char* lineEnd = static_cast<const char*>(memchr(line, '\n', textEnd - line));
+        if (lineEnd == nullptr) {
+            lineEnd = textEnd;
+        }
+        if (lineEnd - line >= 9 && memcmp(line, "processor", 9) == 0) {
+            numProcessors++;
+        }
+        line = lineEnd + 1;
+    }
+    cpus.assign(numProcessors, CpuInfo());
+
+    // The flags line is almost always identical across processors, so remember the last one and
+    // the bits parsed from that line alone (not the owning processor's, which may have more)
+    const char* previousFlags = nullptr;
+    size_t previousFlagsLength = 0;
+    std::bitset<MaxCpuFlags> previousFlagBits;
+
+    CpuInfo* current = nullptr;
+    size_t nextProcessor = 0;
+    for (const char* line = text; line < textEnd;) {
+        const char* lineEnd = static_cast<const char*>(memchr(line, '\n', textEnd - line));
+        if (lineEnd == nullptr) {
+            lineEnd = textEnd;
+        }
+        const char* colon = static_cast<const char*>(memchr(line, ':', lineEnd - line));
+        if (colon == nullptr) {
+            line = lineEnd + 1;
+            continue;
+        }
+
+        // Trim the key and value in place by moving pointers, not by copying
+        const char* key = line;
+        const char* keyEnd = colon;
+        while (keyEnd > key && (keyEnd[-1] == ' ' || keyEnd[-1] == '\t')) {
+            keyEnd--;
+        }
+        const char* value = colon + 1;
+        const char* valueEnd = lineEnd;
+        while (value < valueEnd && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+            valueEnd--;
+        }
+        size_t keyLength = keyEnd - key;
+        size_t valueLength = valueEnd - value;
+
+        if (keyEquals(key, keyLength, "processor")) {
+            current = nextProcessor < cpus.size() ? &cpus[nextProcessor++] : nullptr;
+            if (current != nullptr) {
+                current->processor = parseIntField(value, valueLength);
+            }
+        } else if (current == nullptr) {
+            // Lines before the first processor block (e.g. on some arm64 kernels) are skipped
+        } else if (keyEquals(key, keyLength, "vendor_id")) {
+            copyField(current->vendor, sizeof(current->vendor), value, valueLength);
+        } else if (keyEquals(key, keyLength, "model name")) {
+            copyField(current->modelName, sizeof(current->modelName), value, valueLength);
+        } else if (keyEquals(key, keyLength, "physical id")) {
+            current->physicalId = parseIntField(value, valueLength);
+        } else if (keyEquals(key, keyLength, "core id")) {
+            current->coreId = parseIntField(value, valueLength);
+        } else if (keyEquals(key, keyLength, "siblings")) {
+            current->siblings = parseIntField(value, valueLength);
+        } else if (keyEquals(key, keyLength, "cpu cores")) {
+            current->cpuCores = parseIntField(value, valueLength);
+        } else if (keyEquals(key, keyLength, "address sizes")) {
+            // "46 bits physical, 57 bits virtual"
+            const char* comma = static_cast<const char*>(memchr(value, ',', valueLength));
+            current->physicalAddressBits = parseIntField(value, valueLength);
+            if (comma != nullptr) {
+                const char* virtualBits = comma + 1;
+                while (virtualBits < valueEnd && *virtualBits == ' ') {
+                    virtualBits++;
+                }
+                current->virtualAddressBits = parseIntField(virtualBits, valueEnd - virtualBits);
+            }
+        } else if (keyEquals(key, keyLength, "flags") || keyEquals(key, keyLength, "Features")) {
+            if (previousFlags == nullptr || previousFlagsLength != valueLength ||
+                memcmp(previousFlags, value, valueLength) != 0) {
+                previousFlagBits.reset();
+                for (const char* flag = value; flag < valueEnd;) {
+                    const char* flagEnd = flag;
+                    while (flagEnd < valueEnd && *flagEnd != ' ') {
+                        flagEnd++;
+                    }
+                    int bit = lookupCpuFlag(flag, flagEnd - flag);
+                    if (bit >= 0) {
+                        previousFlagBits.set(bit);
+                    }
+                    flag = flagEnd + 1;
+                }
+            }
+            current->flags |= previousFlagBits;
+            previousFlags = value;
+            previousFlagsLength = valueLength;
+        }
+
+        line = lineEnd + 1;
+    }
+}
+
+// The original parser, kept only as the baseline for --bench-cpuinfo. It uses a vector
+// instead of the fixed array of 8 maps so that it does not overrun on large fixtures.
+static std::vector<std::map<std::string, std::string>> parseCpuInfoLegacy(std::istream& file) {
+    std::vector<std::map<std::string, std::string>> arrayOfCpuInfo;
     std::string line;
-    int numProcessor = 0;
     while (std::getline(file, line)) {
         if (line.find("processor") != std::string::npos) {
-            numProcessor++;
-        } else {
-            // Extract key and value pairs from each line
+            arrayOfCpuInfo.emplace_back();
+        } else if (!arrayOfCpuInfo.empty()) {
             size_t colonPos = line.find(":");
             std::string lineKey = line.substr(0, colonPos);
-            std::string lineValue = line.substr(colonPos + 1); // Skip the colon itself
+            std::string lineValue = line.substr(colonPos + 1);
 
-            // Remove leading and trailing spaces from lineKey and lineValue
             lineKey.erase(lineKey.find_last_not_of(" \t") + 1);
             lineKey.erase(0, lineKey.find_first_not_of(" \t"));
             lineValue.erase(lineValue.find_last_not_of(" \t") + 1);
             lineValue.erase(0, lineValue.find_first_not_of(" \t"));
 
-            arrayOfCpuInfo[numProcessor - 1].insert(std::make_pair(lineKey, lineValue));
+            arrayOfCpuInfo.back().insert(std::make_pair(lineKey, lineValue));
         }
     }
-
-    // -----------------------------------
-    file.close();
-    // -----------------------------------
     return arrayOfCpuInfo;
 }
 
-// Function to print information about processor 0
-void printSectionC() {
-    // SECTION C ------------------------
-    // Read and print processor-specific information
+// Build a synthetic /proc/cpuinfo for numCpus processors on two sockets with SMT
+static std::string buildSyntheticCpuInfo(int numCpus) {
+    std::ostringstream fixture;
+    int cpusPerSocket = std::max(1, numCpus / 2);
+    for (int cpu = 0; cpu < numCpus; ++cpu) {
+        int physicalId = cpu / cpusPerSocket;
+        fixture << "processor\t: " << cpu << "\n"
+                << "vendor_id\t: GenuineIntel\n"
+                << "cpu family\t: 6\n"
+                << "model\t\t: 143\n"
+                << "model name\t: Intel(R) Xeon(R) Platinum 8480+\n"
+                << "stepping\t: 8\n"
+                << "microcode\t: 0x2b000181\n"
+                << "cpu MHz\t\t: 2000.000\n"
+                << "cache size\t: 107520 KB\n"
+                << "physical id\t: " << physicalId << "\n"
+                << "siblings\t: " << cpusPerSocket << "\n"
+                << "core id\t\t: " << (cpu % cpusPerSocket) / 2 << "\n"
+                << "cpu cores\t: " << cpusPerSocket / 2 << "\n"
+                << "apicid\t\t: " << cpu << "\n"
+                << "fpu\t\t: yes\n"
+                << "flags\t\t: fpu vme de pse tsc msr pae mce cx8 apic sep mtrr pge mca cmov pat pse36 "
+                   "clflush dts acpi mmx fxsr sse sse2 ss ht tm pbe syscall nx pdpe1gb rdtscp lm "
+                   "constant_tsc art arch_perfmon pebs bts rep_good nopl xtopology nonstop_tsc cpuid "
+                   "aperfmperf tsc_known_freq pni pclmulqdq dtes64 monitor ds_cpl vmx smx est tm2 ssse3 "
+                   "sdbg fma cx16 xtpr pdcm pcid dca sse4_1 sse4_2 x2apic movbe popcnt aes xsave avx "
+                   "f16c rdrand lahf_lm abm 3dnowprefetch cpuid_fault epb cat_l3 cat_l2 cdp_l3 "
+                   "invpcid_single intel_ppin cdp_l2 ssbd mba ibrs ibpb stibp ibrs_enhanced "
+                   "tpr_shadow flexpriority ept vpid ept_ad fsgsbase tsc_adjust bmi1 hle avx2 smep "
+                   "bmi2 erms invpcid rtm cqm rdt_a avx512f avx512dq rdseed adx smap avx512ifma "
+                   "clflushopt clwb intel_pt avx512cd sha_ni avx512bw avx512vl xsaveopt xsavec "
+                   "xgetbv1 xsaves cqm_llc cqm_occup_llc cqm_mbm_total cqm_mbm_local split_lock_detect "
+                   "avx_vnni avx512_bf16 wbnoinvd dtherm ida arat pln pts hfi vnmi avx512vbmi umip "
+                   "pku ospke waitpkg avx512_vbmi2 gfni vaes vpclmulqdq avx512_vnni avx512_bitalg tme "
+                   "avx512_vpopcntdq la57 rdpid bus_lock_detect cldemote movdiri movdir64b enqcmd "
+                   "fsrm md_clear serialize tsxldtrk pconfig arch_lbr ibt amx_bf16 avx512_fp16 "
+                   "amx_tile amx_int8 flush_l1d arch_capabilities\n"
+                << "bogomips\t: 4000.00\n"
+                << "clflush size\t: 64\n"
+                << "cache_alignment\t: 64\n"
+                << "address sizes\t: 46 bits physical, 57 bits virtual\n"
+                << "power management:\n\n";
+    }
+    return fixture.str();
+}
+
+// Function to time the original map-of-strings parser against parseCpuInfoBuffer
+int runCpuInfoBenchmark(int numCpus, int iterations) {
+    const std::string fixture = buildSyntheticCpuInfo(numCpus);
+
+    // Check that both parsers agree before timing them
+    std::istringstream check(fixture);
+    std::vector<std::map<std::string, std::string>> legacy = parseCpuInfoLegacy(check);
+    std::vector<CpuInfo> cpus;
+    parseCpuInfoBuffer(fixture.data(), fixture.size(), cpus);
+    if (legacy.size() != cpus.size() || legacy.back()["model name"] != cpus.back().modelName) {
+        std::cerr << "Error: parsers disagree on the synthetic fixture" << std::endl;
+        return 1;
+    }
 
-    std::cout << "1. vendor: " << parsedCpuInfo[0]["vendor_id"] << std::endl;
-    std::cout << "2. model name: " << parsedCpuInfo[0]["model name"] << std::endl;
+    size_t checksum = 0;
+    auto legacyStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        std::istringstream file(fixture);
+        checksum += parseCpuInfoLegacy(file).size();
+    }
+    auto legacyEnd = std::chrono::steady_clock::now();
+
+    auto typedStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        parseCpuInfoBuffer(fixture.data(), fixture.size(), cpus);
+        checksum += cpus.size();
+    }
+    auto typedEnd = std::chrono::steady_clock::now();
 
-    // Parse address sizes to extract physical and virtual address sizes
-    std::string addressSizes = parsedCpuInfo[0]["address sizes"];
-    std::istringstream iss(addressSizes);
+    double legacyNs = std::chrono::duration<double, std::nano>(legacyEnd - legacyStart).count() / iterations;
+    double typedNs = std::chrono::duration<double, std::nano>(typedEnd - typedStart).count() / iterations;
 
-    int physicalSize, virtualSize;
+    std::cout << "cpuinfo parser benchmark: " << numCpus << " CPUs, " << fixture.size() << " bytes, "
+              << iterations << " iterations (checksum " << checksum << ")" << '\n';
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "map-of-strings parser: " << legacyNs / 1000.0 << " us/parse, "
+              << legacyNs / numCpus << " ns/cpu" << '\n';
+    std::cout << "typed parser: " << typedNs / 1000.0 << " us/parse, "
+              << typedNs / numCpus << " ns/cpu" << '\n';
+    std::cout << "speedup: " << legacyNs / typedNs << "x" << std::endl;
+    return 0;
+}
 
-    // Read the first number
-    iss >> physicalSize;
+// Function to print information about processor 0
+void printSectionC() {
+    // SECTION C ------------------------
+    ScopedProbe probe(ProbeSectionC);
+    // Read and print processor-specific information
 
-    // Read the 'bits physical' part and discard it
-    iss.ignore(std::numeric_limits<std::streamsize>::max(), ',');
-    iss.ignore(std::numeric_limits<std::streamsize>::max(), ' ');
+    if (parsedCpuInfo.empty()) {
+        std::cerr << "Error: No processors found in /proc/cpuinfo" << std::endl;
+        return;
+    }
+    const CpuInfo& processor0 = parsedCpuInfo[0];
 
-    // Read the second number
-    iss >> virtualSize;
+    std::cout << "1. vendor: " << processor0.vendor << std::endl;
+    std::cout << "2. model name: " << processor0.modelName << std::endl;
 
-    if (iss.fail()) {
+    // Address sizes were already split into physical and virtual bits by the parser
+    if (processor0.physicalAddressBits == 0 || processor0.virtualAddressBits == 0) {
         std::cerr << "Error: Unable to extract numbers from the string." << std::endl;
     }
 
-    std::cout << "3. physical address size: " << physicalSize << " bits" << std::endl;
-    std::cout << "4. virtual address size: " << virtualSize << " bits" << std::endl;
+    std::cout << "3. physical address size: " << processor0.physicalAddressBits << " bits" << std::endl;
+    std::cout << "4. virtual address size: " << processor0.virtualAddressBits << " bits" << std::endl;
     // -----------------------------------
     std::cout << std::endl;
 }
@@ -235,90 +1342,2357 @@ void printSectionC() {
 // Function to print information about processor 5
 void printSectionD() {
     // SECTION D ------------------------
-    std::string statFilePath = "/proc/stat";
-
-    // Read the content from the file
-    std::ifstream file(statFilePath);
-
-    if (!file.is_open()) {
-        std::cerr << "Failed to open " << statFilePath << std::endl;
+    ScopedProbe probe(ProbeSectionD);
+    ProcFile file;
+    if (!file.open(procPath("stat"))) {
+        std::cout << std::endl;
+        return;
     }
 
-    std::string line;
-
-    // Search for the line that starts with "cpu5"
-    while (std::getline(file, line)) {
-        if (line.find("cpu5") == 0) {
-            // Extract CPU statistics from the line
-            std::istringstream line_stream(line);
-            std::string cpu5;
-            int userMode, niceMode, systemMode, idle;
-            line_stream >> cpu5 >> userMode >> niceMode >> systemMode >> idle;
-
-            // Print or store the values as needed
-            std::cout << "1. seconds spent in user mode: " << static_cast<double>(userMode) / sysconf(_SC_CLK_TCK) << std::endl;
-            std::cout << "2. seconds spent in system mode: " << static_cast<double>(systemMode) / sysconf(_SC_CLK_TCK) << std::endl;
-            std::cout << "3. seconds spent idle: " << static_cast<double>(idle) / sysconf(_SC_CLK_TCK) << std::endl;
+    // Tick counters are 64-bit; they overflow an int on long-uptime hosts
+    CpuTimes cpu5;
+    if (parseCpuTimes(file.data(), "cpu5", cpu5)) {
+        double ticksPerSecond = static_cast<double>(sysconf(_SC_CLK_TCK));
+        std::cout << "1. seconds spent in user mode: " << cpu5.user / ticksPerSecond << std::endl;
+        std::cout << "2. seconds spent in system mode: " << cpu5.system / ticksPerSecond << std::endl;
+        std::cout << "3. seconds spent idle: " << cpu5.idle / ticksPerSecond << std::endl;
 
-            double idleSeconds = static_cast<double>(idle) / sysconf(_SC_CLK_TCK);
-            std::cout << "4. formatted time spent in idle: " << convertSecondsToTimeString(idleSeconds) << std::endl;
-        }
+        double idleSeconds = cpu5.idle / ticksPerSecond;
+        std::cout << "4. formatted time spent in idle: " << convertSecondsToTimeString(idleSeconds) << std::endl;
     }
 
     // -----------------------------------
     std::cout << std::endl;
 }
 
-// Function to print the size of the swap device in MB
+// Function to print the size of the swap devices in MB
 void printSectionE() {
     // SECTION E ------------------------
-    std::string swapsFilePath = "/proc/swaps";
-    std::ifstream file(swapsFilePath);
-
-    // Check if the file is open before proceeding
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file: " << swapsFilePath << std::endl;
+    ScopedProbe probe(ProbeSectionE);
+    ProcFile file;
+    if (!file.open(procPath("swaps"))) {
         return;
     }
 
-    // Read the first line and discard it
-    std::string line;
-    std::getline(file, line);
+    // Sum every swap area, not just the first one, and convert KB to MB with 1024.
+    // A host without swap reports 0.
+    SwapTotals swap;
+    parseSwapTotals(file.data(), swap);
+    std::cout << static_cast<double>(swap.sizeKb) / 1024 << std::endl;
+    std::cout << std::endl;
+}
+
+// Function to print memory, fault and swap activity and pressure stall information
+void printSectionF() {
+    // SECTION F ------------------------
+    ScopedProbe probe(ProbeSectionF);
+    ProcFile swapsFile;
+    ProcFile meminfoFile;
+    ProcFile vmstatFile;
+    if (!swapsFile.open(procPath("swaps")) || !meminfoFile.open(procPath("meminfo")) ||
+        !vmstatFile.open(procPath("vmstat"))) {
+        std::cout << std::endl;
+        return;
+    }
 
-    // Read the second line
-    if (std::getline(file, line)) {
-        double swapSizeKb;
-        std::istringstream iss(line);
+    MemorySample memory;
+    parseSwapTotals(swapsFile.data(), memory.swap);
+    parseMemInfo(meminfoFile.data(), memory.meminfo);
+    parseVmStat(vmstatFile.data(), memory.vmstat);
 
-        // Skip the first two columns (/dev/md2 and partition)
-        std::string temp;
-        iss >> temp >> temp;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "1. memory total / available in MB: " << memory.meminfo.memTotal / 1024.0 << " / "
+              << memory.meminfo.memAvailable / 1024.0 << std::endl;
+    std::cout << "2. swap total / used in MB: " << memory.swap.sizeKb / 1024.0 << " / "
+              << memory.swap.usedKb / 1024.0 << " (" << memory.swap.numDevices << " devices)" << std::endl;
+    std::cout << "3. page faults / major faults since boot: " << memory.vmstat.pgfault << " / "
+              << memory.vmstat.pgmajfault << std::endl;
+    std::cout << "4. pages swapped in / out since boot: " << memory.vmstat.pswpin << " / "
+              << memory.vmstat.pswpout << std::endl;
 
-        // Read in swapSizeKb
-        if (iss >> swapSizeKb) {
-            // Convert to MB and print
-            std::cout << swapSizeKb / 1000 << std::endl;
-        } else {
-            std::cerr << "Failed to extract swap size from the second line." << std::endl;
+    // Pressure stall information is only available on kernels built with PSI
+    const char* resources[] = {"cpu", "memory", "io"};
+    for (int i = 0; i < 3; ++i) {
+        std::string pressurePath = procPath("pressure/") + resources[i];
+        if (access(pressurePath.c_str(), R_OK) != 0) {
+            continue;
+        }
+        ProcFile pressureFile;
+        Pressure pressure;
+        if (pressureFile.open(pressurePath) && parsePressure(pressureFile.data(), pressure)) {
+            std::cout << 5 + i << ". " << resources[i] << " pressure avg10/avg60/avg300: some "
+                      << pressure.some.avg10 << "/" << pressure.some.avg60 << "/" << pressure.some.avg300;
+            if (pressure.hasFull) {
+                std::cout << ", full " << pressure.full.avg10 << "/" << pressure.full.avg60 << "/"
+                          << pressure.full.avg300;
+            }
+            std::cout << std::endl;
         }
-    } else {
-        std::cerr << "Failed to read the second line from the file." << std::endl;
     }
+    // -----------------------------------
+    std::cout << std::endl;
 }
 
 // Function to read and print the contents of a file
 void readAndPrintFile(const std::string& filePath) {
-    std::ifstream file(filePath);
-
-    if (!file.is_open()) {
-        std::cerr << "Error: Failed to open file " << filePath << std::endl;
+    ProcFile file;
+    if (!file.open(filePath)) {
         return;
     }
 
-    std::string line;
-    while (std::getline(file, line)) {
-        std::cout << line << std::endl;
+    std::cout << file.data();
+    if (file.size() > 0 && file.data()[file.size() - 1] != '\n') {
+        std::cout << std::endl;
     }
+}
+
+// Close the descriptor when the file goes away
+ProcFile::~ProcFile() {
+    if (fd != -1) {
+        instrumentedClose(fd);
+    }
+}
 
-    file.close();
-}
\ No newline at end of file
+// Function to open a /proc file once and size its buffer
+bool ProcFile::open(const std::string& filePath) {
+    path_ = filePath;
+    fd = instrumentedOpen(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        std::cerr << "Error: Failed to open file " << filePath << std::endl;
+        return false;
+    }
+
+    // Most /proc files report a size of 0, so start with one page and grow on demand
+    buffer.resize(4096);
+    return refresh();
+}
+
+// Function to re-read a /proc file from offset 0 into the existing buffer
+bool ProcFile::refresh() {
+    if (fd == -1) {
+        return false;
+    }
+
+    while (true) {
+        length = 0;
+
+        // Keep one byte free for the terminating NUL
+        while (length < buffer.size() - 1) {
+            ssize_t bytesRead = instrumentedPread(fd, buffer.data() + length, buffer.size() - 1 - length, length);
+            if (bytesRead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Error: Failed to read file " << path_ << std::endl;
+                return false;
+            }
+            if (bytesRead == 0) {
+                break;
+            }
+            length += static_cast<size_t>(bytesRead);
+        }
+
+        // The buffer was large enough, so the whole file is in it
+        if (length < buffer.size() - 1) {
+            buffer[length] = '\0';
+            return true;
+        }
+
+        // Otherwise grow the buffer and read the file again from the start
+        buffer.resize(buffer.size() * 2);
+    }
+}
+
+// Function to find the line that starts with the given prefix
+const char* findLine(const char* text, const char* prefix) {
+    size_t prefixLength = strlen(prefix);
+    const char* line = text;
+    while (line != nullptr && *line != '\0') {
+        if (strncmp(line, prefix, prefixLength) == 0) {
+            return line;
+        }
+        line = strchr(line, '\n');
+        if (line != nullptr) {
+            line++;
+        }
+    }
+    return nullptr;
+}
+
+// Function to parse the uptime in seconds from /proc/uptime
+bool parseUptime(const char* text, double& uptimeSeconds) {
+    char* end = nullptr;
+    uptimeSeconds = strtod(text, &end);
+    return end != text;
+}
+
+// Function to parse the tick counters of one processor from /proc/stat
+bool parseCpuTimes(const char* text, const char* cpuName, CpuTimes& times) {
+    // Search for "cpuN " so that cpu5 does not match cpu50
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "%s ", cpuName);
+    const char* line = findLine(text, prefix);
+    if (line == nullptr) {
+        return false;
+    }
+
+    char* cursor = const_cast<char*>(line) + strlen(prefix);
+    times.user = strtoull(cursor, &cursor, 10);
+    times.nice = strtoull(cursor, &cursor, 10);
+    times.system = strtoull(cursor, &cursor, 10);
+    times.idle = strtoull(cursor, &cursor, 10);
+    return true;
+}
+
+// Function to resize every counter array of a /proc/stat snapshot
+void CpuStatSnapshot::resize(size_t count) {
+    numCpus = count;
+    cpuIds.resize(count);
+    user.resize(count);
+    nice.resize(count);
+    system.resize(count);
+    idle.resize(count);
+    iowait.resize(count);
+    irq.resize(count);
+    softirq.resize(count);
+    steal.resize(count);
+}
+
+// Function to resize every percentage array of a utilization result
+void CpuUtilization::resize(size_t count) {
+    numCpus = count;
+    busy.resize(count);
+    user.resize(count);
+    system.resize(count);
+    iowait.resize(count);
+    steal.resize(count);
+}
+
+// Function to parse every cpuN line of /proc/stat into a structure-of-arrays snapshot
+bool parseCpuStatSnapshot(const char* text, CpuStatSnapshot& snapshot) {
+    // Count the cpuN lines first; they are contiguous right after the aggregate "cpu" line
+    size_t count = 0;
+    for (const char* line = text; line != nullptr && *line != '\0';) {
+        if (strncmp(line, "cpu", 3) == 0 && isdigit(static_cast<unsigned char>(line[3]))) {
+            count++;
+        }
+        line = strchr(line, '\n');
+        if (line != nullptr) {
+            line++;
+        }
+    }
+    snapshot.resize(count);
+
+    size_t index = 0;
+    for (const char* line = text; line != nullptr && *line != '\0' && index < count;) {
+        if (strncmp(line, "cpu", 3) == 0 && isdigit(static_cast<unsigned char>(line[3]))) {
+            // Older kernels print fewer columns; strtoull leaves the missing ones at 0
+            char* cursor = const_cast<char*>(line) + 3;
+            snapshot.cpuIds[index] = static_cast<uint32_t>(strtoul(cursor, &cursor, 10));
+            snapshot.user[index] = strtoull(cursor, &cursor, 10);
+            snapshot.nice[index] = strtoull(cursor, &cursor, 10);
+            snapshot.system[index] = strtoull(cursor, &cursor, 10);
+            snapshot.idle[index] = strtoull(cursor, &cursor, 10);
+            snapshot.iowait[index] = strtoull(cursor, &cursor, 10);
+            snapshot.irq[index] = strtoull(cursor, &cursor, 10);
+            snapshot.softirq[index] = strtoull(cursor, &cursor, 10);
+            snapshot.steal[index] = strtoull(cursor, &cursor, 10);
+            index++;
+        }
+        line = strchr(line, '\n');
+        if (line != nullptr) {
+            line++;
+        }
+    }
+    return count > 0;
+}
+
+// Function to return the ticks a counter advanced in one interval. The subtraction wraps, so a
+// counter that went backwards (iowait may) comes out negative and is clamped to 0. An interval's
+// delta always fits in 32 bits, and int32 keeps the caller's loop vectorizable.
+static inline int32_t tickDelta(uint64_t current, uint64_t previous) {
+    int32_t delta = static_cast<int32_t>(current - previous);
+    return delta > 0 ? delta : 0;
+}
+
+// Function to compute per-processor utilization between two snapshots. The loop body is
+// branch-free over unaliased arrays, so the compiler vectorizes the subtract-and-normalize
+// step (the Makefile's -fvect-cost-model=dynamic lets it at -O2). A processor whose counters did
+// not move reports 0% rather than dividing by zero.
+void computeCpuUtilization(const CpuStatSnapshot& previous, const CpuStatSnapshot& current,
+                           CpuUtilization& utilization) {
+    // CPUs going on- or offline change the layout; report nothing for that interval
+    size_t count = current.numCpus;
+    if (previous.numCpus != count || previous.cpuIds != current.cpuIds) {
+        utilization.resize(0);
+        return;
+    }
+    utilization.resize(count);
+
+    const uint64_t* __restrict prevUser = previous.user.data();
+    const uint64_t* __restrict prevNice = previous.nice.data();
+    const uint64_t* __restrict prevSystem = previous.system.data();
+    const uint64_t* __restrict prevIdle = previous.idle.data();
+    const uint64_t* __restrict prevIowait = previous.iowait.data();
+    const uint64_t* __restrict prevIrq = previous.irq.data();
+    const uint64_t* __restrict prevSoftirq = previous.softirq.data();
+    const uint64_t* __restrict prevSteal = previous.steal.data();
+    const uint64_t* __restrict curUser = current.user.data();
+    const uint64_t* __restrict curNice = current.nice.data();
+    const uint64_t* __restrict curSystem = current.system.data();
+    const uint64_t* __restrict curIdle = current.idle.data();
+    const uint64_t* __restrict curIowait = current.iowait.data();
+    const uint64_t* __restrict curIrq = current.irq.data();
+    const uint64_t* __restrict curSoftirq = current.softirq.data();
+    const uint64_t* __restrict curSteal = current.steal.data();
+    float* __restrict busy = utilization.busy.data();
+    float* __restrict user = utilization.user.data();
+    float* __restrict system = utilization.system.data();
+    float* __restrict iowait = utilization.iowait.data();
+    float* __restrict steal = utilization.steal.data();
+
+    for (size_t i = 0; i < count; ++i) {
+        int32_t userTicks = tickDelta(curUser[i], prevUser[i]) + tickDelta(curNice[i], prevNice[i]);
+        int32_t systemTicks = tickDelta(curSystem[i], prevSystem[i]) + tickDelta(curIrq[i], prevIrq[i]) +
+                              tickDelta(curSoftirq[i], prevSoftirq[i]);
+        int32_t idleTicks = tickDelta(curIdle[i], prevIdle[i]);
+        int32_t iowaitTicks = tickDelta(curIowait[i], prevIowait[i]);
+        int32_t stealTicks = tickDelta(curSteal[i], prevSteal[i]);
+
+        int32_t total = userTicks + systemTicks + idleTicks + iowaitTicks + stealTicks;
+        float scale = 100.0f / static_cast<float>(total > 1 ? total : 1);
+
+        user[i] = static_cast<float>(userTicks) * scale;
+        system[i] = static_cast<float>(systemTicks) * scale;
+        iowait[i] = static_cast<float>(iowaitTicks) * scale;
+        steal[i] = static_cast<float>(stealTicks) * scale;
+        busy[i] = static_cast<float>(userTicks + systemTicks + stealTicks) * scale;
+    }
+}
+
+// Function to sum the size and usage of every swap area in /proc/swaps
+bool parseSwapTotals(const char* text, SwapTotals& totals) {
+    totals = SwapTotals();
+
+    // Skip the header line
+    const char* line = strchr(text, '\n');
+    while (line != nullptr && *(line + 1) != '\0') {
+        line++;
+
+        // Skip the first two columns (/dev/md2 and partition)
+        const char* cursor = line;
+        for (int column = 0; column < 2; ++column) {
+            while (*cursor != '\0' && *cursor != '\n' && !isspace(static_cast<unsigned char>(*cursor))) {
+                cursor++;
+            }
+            while (*cursor == ' ' || *cursor == '\t') {
+                cursor++;
+            }
+        }
+
+        // Then the size and used columns, in KB
+        char* end = nullptr;
+        uint64_t sizeKb = strtoull(cursor, &end, 10);
+        if (end != cursor) {
+            totals.numDevices++;
+            totals.sizeKb += sizeKb;
+            totals.usedKb += strtoull(end, nullptr, 10);
+        }
+        line = strchr(line, '\n');
+    }
+    return totals.numDevices > 0;
+}
+
+// Parse the value of a "Key:   123 kB" line of /proc/meminfo
+static void parseMemInfoField(const char* text, const char* key, uint64_t& value) {
+    const char* line = findLine(text, key);
+    if (line != nullptr) {
+        value = strtoull(line + strlen(key), nullptr, 10);
+    }
+}
+
+// Function to parse the fields of /proc/meminfo used by section F
+bool parseMemInfo(const char* text, MemInfo& meminfo) {
+    parseMemInfoField(text, "MemTotal:", meminfo.memTotal);
+    parseMemInfoField(text, "MemFree:", meminfo.memFree);
+    parseMemInfoField(text, "MemAvailable:", meminfo.memAvailable);
+    parseMemInfoField(text, "Buffers:", meminfo.buffers);
+    parseMemInfoField(text, "Cached:", meminfo.cached);
+    parseMemInfoField(text, "Dirty:", meminfo.dirty);
+    parseMemInfoField(text, "SwapTotal:", meminfo.swapTotal);
+    parseMemInfoField(text, "SwapFree:", meminfo.swapFree);
+    return meminfo.memTotal > 0;
+}
+
+// Function to parse the fault and swap counters of /proc/vmstat in one pass
+bool parseVmStat(const char* text, VmStat& vmstat) {
+    int found = 0;
+    for (const char* line = text; line != nullptr && *line != '\0' && found < 4;) {
+        // All four counters start with 'p', so most lines are rejected on the first byte
+        if (*line == 'p') {
+            uint64_t* field = nullptr;
+            size_t keyLength = 0;
+            if (strncmp(line, "pgfault ", 8) == 0) {
+                field = &vmstat.pgfault;
+                keyLength = 8;
+            } else if (strncmp(line, "pgmajfault ", 11) == 0) {
+                field = &vmstat.pgmajfault;
+                keyLength = 11;
+            } else if (strncmp(line, "pswpin ", 7) == 0) {
+                field = &vmstat.pswpin;
+                keyLength = 7;
+            } else if (strncmp(line, "pswpout ", 8) == 0) {
+                field = &vmstat.pswpout;
+                keyLength = 8;
+            }
+            if (field != nullptr) {
+                *field = strtoull(line + keyLength, nullptr, 10);
+                found++;
+            }
+        }
+        line = strchr(line, '\n');
+        if (line != nullptr) {
+            line++;
+        }
+    }
+    return found == 4;
+}
+
+// Parse "avg10=0.00 avg60=0.00 avg300=0.00 total=0" after the some/full prefix
+static void parsePressureLine(const char* cursor, PressureLine& line) {
+    const char* field = strstr(cursor, "avg10=");
+    if (field != nullptr) {
+        line.avg10 = strtod(field + 6, nullptr);
+    }
+    field = strstr(cursor, "avg60=");
+    if (field != nullptr) {
+        line.avg60 = strtod(field + 6, nullptr);
+    }
+    field = strstr(cursor, "avg300=");
+    if (field != nullptr) {
+        line.avg300 = strtod(field + 7, nullptr);
+    }
+    field = strstr(cursor, "total=");
+    if (field != nullptr) {
+        line.totalUs = strtoull(field + 6, nullptr, 10);
+    }
+}
+
+// Function to parse one /proc/pressure file
+bool parsePressure(const char* text, Pressure& pressure) {
+    const char* some = findLine(text, "some ");
+    if (some == nullptr) {
+        return false;
+    }
+    parsePressureLine(some, pressure.some);
+
+    const char* full = findLine(text, "full ");
+    pressure.hasFull = full != nullptr;
+    if (full != nullptr) {
+        parsePressureLine(full, pressure.full);
+    }
+    return true;
+}
+
+// Percentage of elapsedSeconds spent stalled, from two cumulative PSI totals in microseconds
+static double stallPercent(uint64_t previousUs, uint64_t currentUs, double elapsedSeconds) {
+    return static_cast<double>(currentUs - previousUs) / (elapsedSeconds * 1e6) * 100.0;
+}
+
+// Function to compute per-second rates between two memory samples
+void computeMemoryRates(const MemorySample& previous, const MemorySample& current, double elapsedSeconds,
+                        MemoryRates& rates) {
+    rates = MemoryRates();
+    if (elapsedSeconds <= 0.0) {
+        return;
+    }
+
+    rates.pgfault = (current.vmstat.pgfault - previous.vmstat.pgfault) / elapsedSeconds;
+    rates.pgmajfault = (current.vmstat.pgmajfault - previous.vmstat.pgmajfault) / elapsedSeconds;
+    rates.pswpin = (current.vmstat.pswpin - previous.vmstat.pswpin) / elapsedSeconds;
+    rates.pswpout = (current.vmstat.pswpout - previous.vmstat.pswpout) / elapsedSeconds;
+
+    if (previous.hasPressure && current.hasPressure) {
+        rates.cpuSomeStall = stallPercent(previous.cpu.some.totalUs, current.cpu.some.totalUs, elapsedSeconds);
+        rates.memorySomeStall = stallPercent(previous.memory.some.totalUs, current.memory.some.totalUs, elapsedSeconds);
+        rates.memoryFullStall = stallPercent(previous.memory.full.totalUs, current.memory.full.totalUs, elapsedSeconds);
+        rates.ioSomeStall = stallPercent(previous.io.some.totalUs, current.io.some.totalUs, elapsedSeconds);
+        rates.ioFullStall = stallPercent(previous.io.full.totalUs, current.io.full.totalUs, elapsedSeconds);
+    }
+}
+
+// Function to re-read the sample files and parse them into a sample
+bool collectSample(SampleFiles& files, Sample& sample) {
+    ScopedProbe probe(ProbeSample);
+    if (!files.uptime.refresh() || !files.stat.refresh() || !files.swaps.refresh()) {
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    sample.timestampNs = static_cast<uint64_t>(now.tv_sec) * 1000000000ull + static_cast<uint64_t>(now.tv_nsec);
+
+    if (!parseUptime(files.uptime.data(), sample.uptimeSeconds)) {
+        return false;
+    }
+    sample.hasCpu5 = parseCpuTimes(files.stat.data(), "cpu5", sample.cpu5);
+    parseCpuStatSnapshot(files.stat.data(), sample.cpuStat);
+
+    // The total is known (possibly 0) even on a host without swap
+    parseSwapTotals(files.swaps.data(), sample.memory.swap);
+    sample.hasSwap = true;
+    sample.swapSizeMb = static_cast<double>(sample.memory.swap.sizeKb) / 1024;
+
+    sample.hasMemory = files.withMemory;
+    if (files.withMemory) {
+        if (!files.meminfo.refresh() || !files.vmstat.refresh()) {
+            return false;
+        }
+        parseMemInfo(files.meminfo.data(), sample.memory.meminfo);
+        parseVmStat(files.vmstat.data(), sample.memory.vmstat);
+
+        sample.memory.hasPressure = files.withPressure && files.pressureCpu.refresh() &&
+                                    files.pressureMemory.refresh() && files.pressureIo.refresh() &&
+                                    parsePressure(files.pressureCpu.data(), sample.memory.cpu) &&
+                                    parsePressure(files.pressureMemory.data(), sample.memory.memory) &&
+                                    parsePressure(files.pressureIo.data(), sample.memory.io);
+    }
+    return true;
+}
+
+// Function to append raw bytes to an output buffer
+void OutputBuffer::append(const void* data, size_t size) {
+    reserve(size);
+    memcpy(buffer.data() + length, data, size);
+    length += size;
+}
+
+// Function to append printf-style formatted text to an output buffer
+void OutputBuffer::appendf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    va_list retry;
+    va_copy(retry, args);
+
+    int written = vsnprintf(buffer.data() + length, buffer.size() - length, format, args);
+    if (written >= 0 && static_cast<size_t>(written) >= buffer.size() - length) {
+        // Too long for the space left, so grow and format again
+        reserve(static_cast<size_t>(written) + 1);
+        vsnprintf(buffer.data() + length, buffer.size() - length, format, retry);
+    }
+    if (written > 0) {
+        length += static_cast<size_t>(written);
+    }
+
+    va_end(retry);
+    va_end(args);
+}
+
+// Function to make room for extra more bytes in an output buffer
+void OutputBuffer::reserve(size_t extra) {
+    if (buffer.size() - length < extra) {
+        buffer.resize(std::max(buffer.size() * 2, length + extra));
+    }
+}
+
+// Function to write an output buffer to fd with as few write(2) calls as possible
+bool OutputBuffer::flushTo(int fd) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t result = write(fd, buffer.data() + written, length - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            length = 0;
+            return false;
+        }
+        written += static_cast<size_t>(result);
+    }
+    length = 0;
+    return true;
+}
+
+// Function to write one sample as text, plus one line per processor if requested
+void TextSink::writeSample(long sampleNumber, const Sample& sample, OutputBuffer& out) {
+    static const double ticksPerSecond = static_cast<double>(sysconf(_SC_CLK_TCK));
+
+    char formattedUptime[128];
+    formatSecondsToTimeString(sample.uptimeSeconds, formattedUptime, sizeof(formattedUptime));
+    out.appendf("sample %ld: uptime %.2f s (%s)", sampleNumber, sample.uptimeSeconds, formattedUptime);
+
+    if (sample.hasCpu5) {
+        out.appendf(" | cpu5 user %.2f s, system %.2f s, idle %.2f s",
+                    sample.cpu5.user / ticksPerSecond, sample.cpu5.system / ticksPerSecond,
+                    sample.cpu5.idle / ticksPerSecond);
+    }
+    if (sample.hasSwap) {
+        out.appendf(" | swap %.2f MB", sample.swapSizeMb);
+    }
+    out.append("\n", 1);
+
+    if (sample.hasMemory) {
+        const MemorySample& memory = sample.memory;
+        const MemoryRates& rates = sample.memoryRates;
+        out.appendf("  memory: available %.1f/%.1f MB, swap used %.1f/%.1f MB (%d devices)"
+                    " | faults %.0f/s, major %.0f/s, swap in %.0f/s, out %.0f/s",
+                    memory.meminfo.memAvailable / 1024.0, memory.meminfo.memTotal / 1024.0,
+                    memory.swap.usedKb / 1024.0, memory.swap.sizeKb / 1024.0, memory.swap.numDevices,
+                    rates.pgfault, rates.pgmajfault, rates.pswpin, rates.pswpout);
+        if (memory.hasPressure) {
+            out.appendf(" | stall cpu %.2f%%, memory %.2f%% (full %.2f%%), io %.2f%% (full %.2f%%)",
+                        rates.cpuSomeStall, rates.memorySomeStall, rates.memoryFullStall,
+                        rates.ioSomeStall, rates.ioFullStall);
+        }
+        out.append("\n", 1);
+    }
+
+    if (perCpu) {
+        const CpuUtilization& utilization = sample.utilization;
+        for (size_t i = 0; i < utilization.numCpus; ++i) {
+            out.appendf("  cpu%u: busy %5.1f%% (user %5.1f%%, system %5.1f%%, iowait %5.1f%%, steal %5.1f%%)\n",
+                        sample.cpuStat.cpuIds[i], utilization.busy[i], utilization.user[i],
+                        utilization.system[i], utilization.iowait[i], utilization.steal[i]);
+        }
+    }
+}
+
+// Function to write one sample as a single JSON object on its own line
+void JsonLinesSink::writeSample(long sampleNumber, const Sample& sample, OutputBuffer& out) {
+    out.appendf("{\"sample\":%ld,\"timestamp_ns\":%llu,\"uptime_s\":%.2f", sampleNumber,
+                static_cast<unsigned long long>(sample.timestampNs), sample.uptimeSeconds);
+
+    if (sample.hasCpu5) {
+        out.appendf(",\"cpu5\":{\"user_ticks\":%llu,\"nice_ticks\":%llu,\"system_ticks\":%llu,\"idle_ticks\":%llu}",
+                    static_cast<unsigned long long>(sample.cpu5.user), static_cast<unsigned long long>(sample.cpu5.nice),
+                    static_cast<unsigned long long>(sample.cpu5.system), static_cast<unsigned long long>(sample.cpu5.idle));
+    }
+    if (sample.hasSwap) {
+        out.appendf(",\"swap_mb\":%.2f", sample.swapSizeMb);
+    }
+
+    if (sample.hasMemory) {
+        const MemorySample& memory = sample.memory;
+        const MemoryRates& rates = sample.memoryRates;
+        out.appendf(",\"memory\":{\"mem_total_kb\":%llu,\"mem_available_kb\":%llu,\"swap_devices\":%d,"
+                    "\"swap_size_kb\":%llu,\"swap_used_kb\":%llu,\"pgfault_per_s\":%.1f,\"pgmajfault_per_s\":%.1f,"
+                    "\"pswpin_per_s\":%.1f,\"pswpout_per_s\":%.1f",
+                    static_cast<unsigned long long>(memory.meminfo.memTotal),
+                    static_cast<unsigned long long>(memory.meminfo.memAvailable), memory.swap.numDevices,
+                    static_cast<unsigned long long>(memory.swap.sizeKb),
+                    static_cast<unsigned long long>(memory.swap.usedKb),
+                    rates.pgfault, rates.pgmajfault, rates.pswpin, rates.pswpout);
+        if (memory.hasPressure) {
+            out.appendf(",\"stall_pct\":{\"cpu_some\":%.2f,\"memory_some\":%.2f,\"memory_full\":%.2f,"
+                        "\"io_some\":%.2f,\"io_full\":%.2f}",
+                        rates.cpuSomeStall, rates.memorySomeStall, rates.memoryFullStall,
+                        rates.ioSomeStall, rates.ioFullStall);
+        }
+        out.append("}", 1);
+    }
+
+    if (perCpu) {
+        const CpuUtilization& utilization = sample.utilization;
+        out.append(",\"cpus\":[", 9);
+        for (size_t i = 0; i < utilization.numCpus; ++i) {
+            out.appendf("%s{\"cpu\":%u,\"busy\":%.1f,\"user\":%.1f,\"system\":%.1f,\"iowait\":%.1f,\"steal\":%.1f}",
+                        i == 0 ? "" : ",", sample.cpuStat.cpuIds[i], utilization.busy[i], utilization.user[i],
+                        utilization.system[i], utilization.iowait[i], utilization.steal[i]);
+        }
+        out.append("]", 1);
+    }
+    out.append("}\n", 2);
+}
+
+// Function to write one sample as a fixed-layout binary record
+void BinarySink::writeSample(long sampleNumber, const Sample& sample, OutputBuffer& out) {
+    const CpuUtilization& utilization = sample.utilization;
+
+    BinarySampleHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BinarySampleMagic;
+    header.version = BinarySampleVersion;
+    header.headerSize = sizeof(BinarySampleHeader);
+    header.sampleNumber = static_cast<uint64_t>(sampleNumber);
+    header.timestampNs = sample.timestampNs;
+    header.uptimeSeconds = sample.uptimeSeconds;
+    header.swapSizeMb = sample.swapSizeMb;
+    header.cpu5User = sample.cpu5.user;
+    header.cpu5Nice = sample.cpu5.nice;
+    header.cpu5System = sample.cpu5.system;
+    header.cpu5Idle = sample.cpu5.idle;
+    header.flags = (sample.hasCpu5 ? BinaryHasCpu5 : 0) | (sample.hasSwap ? BinaryHasSwap : 0) |
+                   (sample.hasMemory ? BinaryHasMemory : 0);
+    header.numCpus = perCpu ? static_cast<uint32_t>(utilization.numCpus) : 0;
+    out.append(&header, sizeof(header));
+
+    if (sample.hasMemory) {
+        BinaryMemoryRecord memory;
+        memory.memTotalKb = sample.memory.meminfo.memTotal;
+        memory.memAvailableKb = sample.memory.meminfo.memAvailable;
+        memory.swapSizeKb = sample.memory.swap.sizeKb;
+        memory.swapUsedKb = sample.memory.swap.usedKb;
+        memory.pgfaultPerSecond = sample.memoryRates.pgfault;
+        memory.pgmajfaultPerSecond = sample.memoryRates.pgmajfault;
+        memory.pswpinPerSecond = sample.memoryRates.pswpin;
+        memory.pswpoutPerSecond = sample.memoryRates.pswpout;
+        memory.cpuSomeStall = sample.memoryRates.cpuSomeStall;
+        memory.memorySomeStall = sample.memoryRates.memorySomeStall;
+        memory.memoryFullStall = sample.memoryRates.memoryFullStall;
+        memory.ioSomeStall = sample.memoryRates.ioSomeStall;
+        memory.ioFullStall = sample.memoryRates.ioFullStall;
+        out.append(&memory, sizeof(memory));
+    }
+
+    for (uint32_t i = 0; i < header.numCpus; ++i) {
+        BinaryCpuRecord record;
+        record.cpuId = sample.cpuStat.cpuIds[i];
+        record.busy = utilization.busy[i];
+        record.user = utilization.user[i];
+        record.system = utilization.system[i];
+        record.iowait = utilization.iowait[i];
+        record.steal = utilization.steal[i];
+        out.append(&record, sizeof(record));
+    }
+}
+
+// Function to create the sink for an output format
+std::unique_ptr<OutputSink> makeOutputSink(OutputFormat format, bool perCpu) {
+    switch (format) {
+    case OutputFormat::JsonLines:
+        return std::unique_ptr<OutputSink>(new JsonLinesSink(perCpu));
+    case OutputFormat::Binary:
+        return std::unique_ptr<OutputSink>(new BinarySink(perCpu));
+    case OutputFormat::Text:
+    default:
+        return std::unique_ptr<OutputSink>(new TextSink(perCpu));
+    }
+}
+
+// Function to sample the system every intervalSeconds until count samples are printed
+int runSamplingMode(const SamplingOptions& options) {
+    const double intervalSeconds = options.intervalSeconds;
+    const long count = options.count;
+
+    // Open every file once; each sample re-reads them with pread()
+    SampleFiles files;
+    if (!files.uptime.open(procPath("uptime")) || !files.stat.open(procPath("stat")) ||
+        !files.swaps.open(procPath("swaps"))) {
+        return 1;
+    }
+    if (options.memory) {
+        if (!files.meminfo.open(procPath("meminfo")) || !files.vmstat.open(procPath("vmstat"))) {
+            return 1;
+        }
+        files.withMemory = true;
+        files.withPressure = access(procPath("pressure/cpu").c_str(), R_OK) == 0 &&
+                             files.pressureCpu.open(procPath("pressure/cpu")) &&
+                             files.pressureMemory.open(procPath("pressure/memory")) &&
+                             files.pressureIo.open(procPath("pressure/io"));
+    }
+
+    // Schedule samples on absolute deadlines so the interval does not drift
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    long intervalNs = static_cast<long>(intervalSeconds * 1e9);
+
+    // Utilization needs the previous sample; the two are swapped rather than copied
+    Sample previous;
+    Sample sample;
+    std::unique_ptr<OutputSink> sink = makeOutputSink(options.format, options.perCpu);
+    OutputBuffer out;
+    collectSample(files, previous);
+
+    // Keep recent samples for the query socket; the ring is sized from the first sample
+    std::unique_ptr<SampleRing> ring;
+    std::unique_ptr<QueryServer> server;
+    if (!options.servePath.empty()) {
+        ring.reset(new SampleRing(options.historySize, previous.cpuStat.numCpus));
+        server.reset(new QueryServer(*ring, options.servePath));
+        if (!server->start()) {
+            return 1;
+        }
+    }
+
+    for (long sampleNumber = 1; count == 0 || sampleNumber <= count; ++sampleNumber) {
+        // Wait one interval first so that every sample covers a full interval
+        sleepUntilNextInterval(deadline, intervalNs);
+
+        if (collectSample(files, sample)) {
+            computeCpuUtilization(previous.cpuStat, sample.cpuStat, sample.utilization);
+            if (sample.hasMemory) {
+                double elapsedSeconds = (sample.timestampNs - previous.timestampNs) / 1e9;
+                computeMemoryRates(previous.memory, sample.memory, elapsedSeconds, sample.memoryRates);
+            }
+            // Each sample reaches stdout with one buffered write(2)
+            sink->writeSample(sampleNumber, sample, out);
+            if (!out.flushTo(STDOUT_FILENO)) {
+                std::cerr << "Error: Failed to write sample " << sampleNumber << std::endl;
+                return 1;
+            }
+            if (ring) {
+                ring->publish(sampleNumber, sample);
+            }
+            std::swap(previous, sample);
+        } else {
+            std::cerr << "Error: Failed to collect sample " << sampleNumber << std::endl;
+        }
+    }
+
+    return 0;
+}
+
+// Read a small sysfs file into buf; returns false if it does not exist
+static bool readSysfsFile(const std::string& filePath, char* buf, size_t bufSize) {
+    int fd = instrumentedOpen(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    ssize_t bytesRead = instrumentedRead(fd, buf, bufSize - 1);
+    instrumentedClose(fd);
+    if (bytesRead <= 0) {
+        return false;
+    }
+    buf[bytesRead] = '\0';
+    return true;
+}
+
+// Read a sysfs file holding one integer
+static bool readSysfsInt(const std::string& filePath, int& value) {
+    char buf[64];
+    if (!readSysfsFile(filePath, buf, sizeof(buf))) {
+        return false;
+    }
+    char* end = nullptr;
+    long parsed = strtol(buf, &end, 10);
+    if (end == buf) {
+        return false;
+    }
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+// Highest processor number accepted in a cpu list; the kernel's NR_CPUS tops out at 8192
+static const long maxCpuNumber = 8191;
+
+// Function to parse a sysfs cpu list such as "0-3,8-11". A list with a negative, reversed or
+// out-of-range entry is rejected as a whole, so a corrupt file cannot make it allocate without bound.
+std::vector<int> parseCpuList(const char* text) {
+    std::vector<int> cpus;
+    const char* cursor = text;
+    while (*cursor != '\0') {
+        char* end = nullptr;
+        long first = strtol(cursor, &end, 10);
+        if (end == cursor) {
+            break;
+        }
+        long last = first;
+        cursor = end;
+        if (*cursor == '-') {
+            last = strtol(cursor + 1, &end, 10);
+            cursor = end;
+        }
+        if (first < 0 || last < first || last > maxCpuNumber) {
+            return {};
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+        if (*cursor != ',') {
+            break;
+        }
+        cursor++;
+    }
+    return cpus;
+}
+
+// Function to format cpu numbers as a sysfs-style cpu list
+std::string formatCpuList(const std::vector<int>& cpus) {
+    std::ostringstream list;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        if (i != 0) {
+            list << ",";
+        }
+        list << cpus[i];
+        if (j != i) {
+            list << "-" << cpus[j];
+        }
+        i = j + 1;
+    }
+    return list.str();
+}
+
+// Function to build the socket -> core -> thread tree and the NUMA node map
+void Topology::build(const std::vector<CpuInfo>& cpus, const std::string& sysRoot) {
+    threads.clear();
+    sockets.clear();
+    nodes.clear();
+
+    const std::string cpuDir = sysRoot + "/devices/system/cpu/";
+    const std::string nodeDir = sysRoot + "/devices/system/node/";
+
+    // The processor list comes from cpuinfo; fall back to sysfs if cpuinfo had none
+    std::vector<int> cpuNumbers;
+    for (const CpuInfo& cpuInfo : cpus) {
+        cpuNumbers.push_back(cpuInfo.processor);
+    }
+    if (cpuNumbers.empty()) {
+        char buf[4096];
+        if (readSysfsFile(cpuDir + "present", buf, sizeof(buf))) {
+            cpuNumbers = parseCpuList(buf);
+        }
+    }
+
+    // NUMA node membership from nodeN/cpulist
+    DIR* dir = opendir(nodeDir.c_str());
+    if (dir != nullptr) {
+        while (struct dirent* entry = readdir(dir)) {
+            if (strncmp(entry->d_name, "node", 4) != 0 || !isdigit(static_cast<unsigned char>(entry->d_name[4]))) {
+                continue;
+            }
+            char buf[4096];
+            if (readSysfsFile(nodeDir + entry->d_name + "/cpulist", buf, sizeof(buf))) {
+                nodes[atoi(entry->d_name + 4)] = parseCpuList(buf);
+            }
+        }
+        closedir(dir);
+    }
+
+    // Package and core ids come from sysfs, then cpuinfo, then one core per processor
+    for (size_t i = 0; i < cpuNumbers.size(); ++i) {
+        HardwareThread thread;
+        thread.cpu = cpuNumbers[i];
+        thread.socketId = i < cpus.size() && cpus[i].physicalId >= 0 ? cpus[i].physicalId : 0;
+        thread.coreId = i < cpus.size() && cpus[i].coreId >= 0 ? cpus[i].coreId : thread.cpu;
+        thread.node = -1;
+
+        const std::string topologyDir = cpuDir + "cpu" + std::to_string(thread.cpu) + "/topology/";
+        readSysfsInt(topologyDir + "physical_package_id", thread.socketId);
+        readSysfsInt(topologyDir + "core_id", thread.coreId);
+        threads.push_back(thread);
+    }
+    for (const auto& nodeCpus : nodes) {
+        for (int cpu : nodeCpus.second) {
+            for (HardwareThread& thread : threads) {
+                if (thread.cpu == cpu) {
+                    thread.node = nodeCpus.first;
+                }
+            }
+        }
+    }
+
+    // Group threads into cores and cores into sockets
+    std::sort(threads.begin(), threads.end(), [](const HardwareThread& a, const HardwareThread& b) {
+        if (a.socketId != b.socketId) {
+            return a.socketId < b.socketId;
+        }
+        if (a.coreId != b.coreId) {
+            return a.coreId < b.coreId;
+        }
+        return a.cpu < b.cpu;
+    });
+    for (const HardwareThread& thread : threads) {
+        if (sockets.empty() || sockets.back().socketId != thread.socketId) {
+            sockets.push_back(Socket{thread.socketId, {}});
+        }
+        Socket& socket = sockets.back();
+        if (socket.cores.empty() || socket.cores.back().coreId != thread.coreId) {
+            socket.cores.push_back(Core{thread.coreId, {}});
+        }
+        socket.cores.back().cpus.push_back(thread.cpu);
+    }
+    std::sort(threads.begin(), threads.end(), [](const HardwareThread& a, const HardwareThread& b) {
+        return a.cpu < b.cpu;
+    });
+}
+
+// Function to count the cores on all sockets
+size_t Topology::numCores() const {
+    size_t count = 0;
+    for (const Socket& socket : sockets) {
+        count += socket.cores.size();
+    }
+    return count;
+}
+
+// Function to count the sockets that have more than one core
+size_t Topology::numMultiCoreSockets() const {
+    size_t count = 0;
+    for (const Socket& socket : sockets) {
+        if (socket.cores.size() > 1) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Function to find the hardware thread for a processor number
+const Topology::HardwareThread* Topology::findThread(int cpu) const {
+    auto iter = std::lower_bound(threads.begin(), threads.end(), cpu,
+                                 [](const HardwareThread& thread, int value) { return thread.cpu < value; });
+    return iter != threads.end() && iter->cpu == cpu ? &*iter : nullptr;
+}
+
+// Function to list the hardware threads that share a core with cpu
+std::vector<int> Topology::siblingsOf(int cpu) const {
+    const HardwareThread* thread = findThread(cpu);
+    if (thread == nullptr) {
+        return {};
+    }
+    for (const Socket& socket : sockets) {
+        if (socket.socketId != thread->socketId) {
+            continue;
+        }
+        for (const Core& core : socket.cores) {
+            if (core.coreId == thread->coreId) {
+                return core.cpus;
+            }
+        }
+    }
+    return {};
+}
+
+// Function to list the processors on a NUMA node
+std::vector<int> Topology::cpusOnNode(int node) const {
+    auto iter = nodes.find(node);
+    return iter != nodes.end() ? iter->second : std::vector<int>();
+}
+
+// Function to return the NUMA node of a processor
+int Topology::nodeOf(int cpu) const {
+    const HardwareThread* thread = findThread(cpu);
+    return thread != nullptr ? thread->node : -1;
+}
+
+// Function to print the topology tree and the NUMA nodes
+void Topology::print(std::ostream& out) const {
+    out << "Topology: " << numSockets() << " sockets, " << numCores() << " cores, "
+        << numThreads() << " hardware threads, " << numNodes() << " NUMA nodes" << std::endl;
+    for (const Socket& socket : sockets) {
+        out << "socket " << socket.socketId << ": " << socket.cores.size() << " cores" << std::endl;
+        for (const Core& core : socket.cores) {
+            out << "  core " << core.coreId << ": cpus " << formatCpuList(core.cpus) << std::endl;
+        }
+    }
+    for (const auto& node : nodes) {
+        out << "node " << node.first << ": cpus " << formatCpuList(node.second) << std::endl;
+    }
+}
+
+// Function to print the topology or answer a siblings/node query
+int runTopologyMode(const std::string& sysRoot, int siblingsCpu, int node) {
+    Topology topology;
+    topology.build(parsedCpuInfo, sysRoot);
+
+    if (siblingsCpu >= 0) {
+        std::vector<int> siblings = topology.siblingsOf(siblingsCpu);
+        if (siblings.empty()) {
+            std::cerr << "Error: Unknown cpu " << siblingsCpu << std::endl;
+            return 1;
+        }
+        std::cout << "siblings of cpu " << siblingsCpu << ": " << formatCpuList(siblings) << std::endl;
+    }
+    if (node >= 0) {
+        std::vector<int> nodeCpus = topology.cpusOnNode(node);
+        if (nodeCpus.empty()) {
+            std::cerr << "Error: Unknown NUMA node " << node << std::endl;
+            return 1;
+        }
+        std::cout << "cpus on node " << node << ": " << formatCpuList(nodeCpus) << std::endl;
+    }
+    if (siblingsCpu < 0 && node < 0) {
+        topology.print(std::cout);
+    }
+    return 0;
+}
+
+// Function to return the proc directory beside a sys root, e.g. "fixture/proc" for "fixture/sys"
+std::string siblingProcRoot(const std::string& sysRootPath) {
+    std::string parent = sysRootPath;
+    while (parent.size() > 1 && parent.back() == '/') {
+        parent.pop_back();
+    }
+    size_t slash = parent.rfind('/');
+    if (slash == std::string::npos) {
+        return "proc";
+    }
+    return parent.substr(0, slash) + "/proc";
+}
+
+// Function to build the path of a file under the proc root
+std::string procPath(const char* relativePath) {
+    return procRoot + "/" + relativePath;
+}
+
+// Files recorded in each capture snapshot, relative to the proc root
+static const char* const capturedFileNames[] = {
+    "sys/kernel/ostype", "sys/kernel/hostname", "sys/kernel/osrelease", "sys/kernel/version",
+    "cpuinfo", "uptime", "stat", "swaps", "meminfo", "vmstat"
+};
+static const size_t numCapturedFiles = sizeof(capturedFileNames) / sizeof(capturedFileNames[0]);
+enum CapturedFile {
+    CapOstype, CapHostname, CapOsrelease, CapVersion, CapCpuinfo, CapUptime, CapStat, CapSwaps, CapMeminfo, CapVmstat
+};
+
+// Header line of a capture file. The sysfs files that Topology::build reads come first, as
+// "T <name> <length>\n<length bytes>\0" records named relative to the sys root; they do not
+// change while the machine runs. Each snapshot is then "S <timestamp ns>\n", followed by one
+// "F <name> <length>\n<length bytes>\0" record per captured file. The NUL keeps every file
+// terminated in place when the capture is memory-mapped for replay.
+static const char captureMagic[] = "PROCCAP 3\n";
+
+// Function to call visit with the name of every entry of a directory that is prefix followed
+// by a number, such as cpu0 or node1
+template <typename Visit>
+static void forEachNumberedEntry(const std::string& dirPath, const char* prefix, Visit visit) {
+    DIR* dir = opendir(dirPath.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    size_t prefixLength = strlen(prefix);
+    while (struct dirent* entry = readdir(dir)) {
+        if (strncmp(entry->d_name, prefix, prefixLength) == 0 &&
+            isdigit(static_cast<unsigned char>(entry->d_name[prefixLength]))) {
+            visit(entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+// Function to append the sysfs topology files (present cpus, package and core ids, NUMA node
+// cpu lists) as "T" records, so that a replay does not depend on the replaying machine's /sys
+static void appendTopologyFiles(OutputBuffer& out) {
+    char buf[4096];
+    auto record = [&](const std::string& name) {
+        if (readSysfsFile(sysRoot + "/" + name, buf, sizeof(buf))) {
+            size_t size = strlen(buf);
+            out.appendf("T %s %zu\n", name.c_str(), size);
+            out.append(buf, size + 1);
+        }
+    };
+
+    record("devices/system/cpu/present");
+    forEachNumberedEntry(sysRoot + "/devices/system/cpu", "cpu", [&](const char* cpu) {
+        record(std::string("devices/system/cpu/") + cpu + "/topology/physical_package_id");
+        record(std::string("devices/system/cpu/") + cpu + "/topology/core_id");
+    });
+    forEachNumberedEntry(sysRoot + "/devices/system/node", "node", [&](const char* node) {
+        record(std::string("devices/system/node/") + node + "/cpulist");
+    });
+}
+
+// Function to record count snapshots of the section A-E files into one capture file
+int runCaptureMode(const std::string& capturePath, double intervalSeconds, long count) {
+    ProcFile files[numCapturedFiles];
+    for (size_t i = 0; i < numCapturedFiles; ++i) {
+        if (!files[i].open(procPath(capturedFileNames[i]))) {
+            return 1;
+        }
+    }
+
+    int fd = ::open(capturePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        std::cerr << "Error: Failed to open file " << capturePath << std::endl;
+        return 1;
+    }
+
+    OutputBuffer out;
+    out.append(captureMagic, sizeof(captureMagic) - 1);
+    appendTopologyFiles(out);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    long intervalNs = static_cast<long>(intervalSeconds * 1e9);
+
+    for (long snapshot = 0; snapshot < count; ++snapshot) {
+        if (snapshot > 0) {
+            sleepUntilNextInterval(deadline, intervalNs);
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        out.appendf("S %llu\n", static_cast<unsigned long long>(now.tv_sec) * 1000000000ull +
+                                    static_cast<unsigned long long>(now.tv_nsec));
+
+        for (size_t i = 0; i < numCapturedFiles; ++i) {
+            if (!files[i].refresh()) {
+                close(fd);
+                return 1;
+            }
+            out.appendf("F %s %zu\n", capturedFileNames[i], files[i].size());
+            out.append(files[i].data(), files[i].size() + 1);
+        }
+
+        // One write per snapshot
+        if (!out.flushTo(fd)) {
+            std::cerr << "Error: Failed to write file " << capturePath << std::endl;
+            close(fd);
+            return 1;
+        }
+    }
+
+    close(fd);
+    std::cout << "Captured " << count << " snapshots into " << capturePath << std::endl;
+    return 0;
+}
+
+// One snapshot of a memory-mapped capture file; every file points into the mapping
+struct CapturedSnapshot {
+    const char* data[numCapturedFiles];
+    size_t size[numCapturedFiles];
+};
+
+// One sysfs file of a memory-mapped capture, named relative to the sys root
+struct CapturedSysfsFile {
+    std::string name;
+    const char* data;
+    size_t size;
+};
+
+// Function to check that a name from a capture stays inside the directory it is unpacked into
+static bool isSafeRelativePath(const std::string& name) {
+    return !name.empty() && name[0] != '/' && name.find("..") == std::string::npos &&
+           name.find("//") == std::string::npos;
+}
+
+// Split a memory-mapped capture into snapshots and the sysfs files shared by all of them
+static bool indexCapture(const char* text, size_t length, std::vector<CapturedSnapshot>& snapshots,
+                         std::vector<CapturedSysfsFile>& sysfsFiles) {
+    const char* const textEnd = text + length;
+    const size_t magicLength = sizeof(captureMagic) - 1;
+    if (length < magicLength || memcmp(text, captureMagic, magicLength) != 0) {
+        return false;
+    }
+
+    const char* cursor = text + magicLength;
+    while (cursor < textEnd) {
+        const char* lineEnd = static_cast<const char*>(memchr(cursor, '\n', textEnd - cursor));
+        if (lineEnd == nullptr) {
+            return false;
+        }
+
+        if (*cursor == 'S') {
+            CapturedSnapshot snapshot;
+            memset(&snapshot, 0, sizeof(snapshot));
+            snapshots.push_back(snapshot);
+        } else if ((*cursor == 'F' && !snapshots.empty()) || (*cursor == 'T' && snapshots.empty())) {
+            // "F <name> <length>" or "T <name> <length>"; everything is checked against the line and the mapping, as
+            // a truncated or corrupt capture must not make the replay read past either
+            if (lineEnd - cursor < 2) {
+                return false;
+            }
+            const char* name = cursor + 2;
+            const char* nameEnd = static_cast<const char*>(memchr(name, ' ', lineEnd - name));
+            if (nameEnd == nullptr) {
+                return false;
+            }
+            char* lengthEnd = nullptr;
+            size_t fileLength = strtoull(nameEnd + 1, &lengthEnd, 10);
+            if (lengthEnd != lineEnd) {
+                return false;
+            }
+            const char* fileData = lineEnd + 1;
+            if (fileLength >= static_cast<size_t>(textEnd - fileData) || fileData[fileLength] != '\0') {
+                return false;
+            }
+            if (*cursor == 'T') {
+                std::string sysfsName(name, nameEnd - name);
+                if (!isSafeRelativePath(sysfsName)) {
+                    return false;
+                }
+                sysfsFiles.push_back(CapturedSysfsFile{sysfsName, fileData, fileLength});
+            }
+            for (size_t i = 0; i < numCapturedFiles && *cursor == 'F'; ++i) {
+                if (keyEquals(name, nameEnd - name, capturedFileNames[i])) {
+                    snapshots.back().data[i] = fileData;
+                    snapshots.back().size[i] = fileLength;
+                }
+            }
+            cursor = fileData + fileLength + 1;
+            continue;
+        } else {
+            return false;
+        }
+        cursor = lineEnd + 1;
+    }
+
+    // Every snapshot must have every file
+    for (const CapturedSnapshot& snapshot : snapshots) {
+        for (size_t i = 0; i < numCapturedFiles; ++i) {
+            if (snapshot.data[i] == nullptr) {
+                return false;
+            }
+        }
+    }
+    return !snapshots.empty();
+}
+
+// Stream buffer that throws output away but counts it, so the replay can run the real section
+// printers without the terminal in the measurement
+class CountingNullBuffer : public std::streambuf {
+public:
+    size_t count = 0;
+
+protected:
+    int overflow(int c) override {
+        count++;
+        return traits_type::not_eof(c);
+    }
+    std::streamsize xsputn(const char*, std::streamsize n) override {
+        count += static_cast<size_t>(n);
+        return n;
+    }
+};
+
+// Files unpacked from a capture under a temporary directory, and removed from it again
+class ReplayTree {
+public:
+    explicit ReplayTree(const std::string& root) : root(root) {}
+    ~ReplayTree() { remove(); }
+    ReplayTree(const ReplayTree&) = delete;
+    ReplayTree& operator=(const ReplayTree&) = delete;
+
+    // Write a file at a path relative to the root, creating its directories
+    bool add(const std::string& name, const char* data, size_t size);
+
+    // Remove every file and directory that add() created, and the root
+    void remove();
+
+private:
+    std::string root;
+    std::vector<std::string> files;
+    std::vector<std::string> directories; // In creation order
+};
+
+// Function to write one unpacked file, creating the directories above it
+bool ReplayTree::add(const std::string& name, const char* data, size_t size) {
+    for (size_t slash = name.find('/'); slash != std::string::npos; slash = name.find('/', slash + 1)) {
+        std::string directory = root + "/" + name.substr(0, slash);
+        if (mkdir(directory.c_str(), 0700) == 0) {
+            directories.push_back(directory);
+        } else if (errno != EEXIST) {
+            return false;
+        }
+    }
+
+    std::string filePath = root + "/" + name;
+    int fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return false;
+    }
+    files.push_back(filePath);
+    OutputBuffer out;
+    out.append(data, size);
+    bool written = out.flushTo(fd);
+    close(fd);
+    return written;
+}
+
+// Function to remove the unpacked tree, deepest directories first
+void ReplayTree::remove() {
+    for (const std::string& filePath : files) {
+        unlink(filePath.c_str());
+    }
+    for (auto directory = directories.rbegin(); directory != directories.rend(); ++directory) {
+        rmdir(directory->c_str());
+    }
+    files.clear();
+    directories.clear();
+    rmdir(root.c_str());
+}
+
+// Time one section's parse work over every snapshot, iterations times, in ns per snapshot
+template <typename ParseSection>
+static double timeSection(const std::vector<CapturedSnapshot>& snapshots, long iterations, ParseSection parse) {
+    auto start = std::chrono::steady_clock::now();
+    for (long iteration = 0; iteration < iterations; ++iteration) {
+        for (size_t i = 0; i < snapshots.size(); ++i) {
+            parse(i);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (iterations * snapshots.size());
+}
+
+// Function to replay a capture through the section A-F printers, with the proc root pointing at
+// each snapshot in turn, and report ns/op as CSV
+int runReplayMode(const std::string& capturePath, long iterations) {
+    int fd = ::open(capturePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        std::cerr << "Error: Failed to open file " << capturePath << std::endl;
+        return 1;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1 || fileStat.st_size == 0) {
+        std::cerr << "Error: Failed to read file " << capturePath << std::endl;
+        close(fd);
+        return 1;
+    }
+    size_t mappedSize = static_cast<size_t>(fileStat.st_size);
+    void* mapped = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Error: Failed to map file " << capturePath << std::endl;
+        return 1;
+    }
+
+    std::vector<CapturedSnapshot> snapshots;
+    std::vector<CapturedSysfsFile> sysfsFiles;
+    if (!indexCapture(static_cast<const char*>(mapped), mappedSize, snapshots, sysfsFiles)) {
+        std::cerr << "Error: " << capturePath << " is not a valid capture file" << std::endl;
+        munmap(mapped, mappedSize);
+        return 1;
+    }
+
+    // Unpack every snapshot into its own proc-like tree and the sysfs files into a sys-like one,
+    // so that the sections run unchanged with the proc and sys roots pointing at them
+    const char* tmpDir = getenv("TMPDIR");
+    std::string replayTemplate = std::string(tmpDir != nullptr ? tmpDir : "/tmp") + "/proc-replay.XXXXXX";
+    std::vector<char> replayDirBuffer(replayTemplate.begin(), replayTemplate.end());
+    replayDirBuffer.push_back('\0');
+    if (mkdtemp(replayDirBuffer.data()) == nullptr) {
+        std::cerr << "Error: Failed to create a directory for " << replayTemplate << std::endl;
+        munmap(mapped, mappedSize);
+        return 1;
+    }
+    const std::string replayDir = replayDirBuffer.data();
+    ReplayTree tree(replayDir);
+    std::vector<std::string> snapshotRoots;
+    bool unpacked = true;
+    for (size_t i = 0; i < snapshots.size() && unpacked; ++i) {
+        snapshotRoots.push_back(replayDir + "/" + std::to_string(i));
+        for (size_t file = 0; file < numCapturedFiles && unpacked; ++file) {
+            unpacked = tree.add(std::to_string(i) + "/" + capturedFileNames[file], snapshots[i].data[file],
+                                snapshots[i].size[file]);
+        }
+    }
+    const std::string replaySysRoot = replayDir + "/sys";
+    for (size_t i = 0; i < sysfsFiles.size() && unpacked; ++i) {
+        unpacked = tree.add("sys/" + sysfsFiles[i].name, sysfsFiles[i].data, sysfsFiles[i].size);
+    }
+    if (unpacked && mkdir(replaySysRoot.c_str(), 0700) == -1 && errno != EEXIST) {
+        unpacked = false;
+    }
+
+    // Per-CPU utilization and memory rates need two snapshots, so they run on the mapping
+    CpuStatSnapshot stat[2];
+    CpuUtilization utilization;
+    MemorySample memory[2];
+    MemoryRates rates;
+    volatile size_t checksum = 0;
+    double sectionA = 0, cpuinfo = 0, sectionB = 0, sectionC = 0, sectionD = 0, sectionE = 0, sectionF = 0;
+    double cpuUtilization = 0, memoryRates = 0;
+
+    size_t errorOutput = 0;
+    if (unpacked) {
+        // The sections print; count their output instead of timing the terminal. Anything on
+        // stderr means a section failed and was timed as an early return, which fails the replay.
+        CountingNullBuffer discard;
+        CountingNullBuffer errors;
+        std::streambuf* savedOut = std::cout.rdbuf(&discard);
+        std::streambuf* savedErr = std::cerr.rdbuf(&errors);
+        const std::string savedProcRoot = procRoot;
+        const std::string savedSysRoot = sysRoot;
+        sysRoot = replaySysRoot;
+
+        sectionA = timeSection(snapshots, iterations, [&](size_t i) {
+            procRoot = snapshotRoots[i];
+            printSectionA();
+        });
+        cpuinfo = timeSection(snapshots, iterations, [&](size_t i) {
+            procRoot = snapshotRoots[i];
+            parsedCpuInfo = parseCpuInfo();
+        });
+        sectionB = timeSection(snapshots, iterations, [&](size_t i) {
+            procRoot = snapshotRoots[i];
+            printSectionB();
+        });
+        sectionC = timeSection(snapshots, iterations, [&](size_t i) {
+            procRoot = snapshotRoots[i];
+            printSectionC();
+        });
+        sectionD = timeSection(snapshots, iterations, [&](size_t i) {
+            procRoot = snapshotRoots[i];
+            printSectionD();
+        });
+        sectionE = timeSection(snapshots, iterations, [&](size_t i) {
+            procRoot = snapshotRoots[i];
+            printSectionE();
+        });
+        sectionF = timeSection(snapshots, iterations, [&](size_t i) {
+            procRoot = snapshotRoots[i];
+            printSectionF();
+        });
+
+        procRoot = savedProcRoot;
+        sysRoot = savedSysRoot;
+        std::cout.rdbuf(savedOut);
+        std::cerr.rdbuf(savedErr);
+        checksum += discard.count;
+        errorOutput = errors.count;
+
+        cpuUtilization = timeSection(snapshots, iterations, [&](size_t i) {
+            CpuStatSnapshot& current = stat[i % 2];
+            parseCpuStatSnapshot(snapshots[i].data[CapStat], current);
+            computeCpuUtilization(stat[(i + 1) % 2], current, utilization);
+            checksum += utilization.numCpus;
+        });
+        memoryRates = timeSection(snapshots, iterations, [&](size_t i) {
+            MemorySample& current = memory[i % 2];
+            parseMemInfo(snapshots[i].data[CapMeminfo], current.meminfo);
+            parseVmStat(snapshots[i].data[CapVmstat], current.vmstat);
+            computeMemoryRates(memory[(i + 1) % 2], current, 1.0, rates);
+            checksum += current.meminfo.memAvailable + static_cast<size_t>(rates.pgfault);
+        });
+    }
+
+    tree.remove();
+    munmap(mapped, mappedSize);
+    if (!unpacked) {
+        std::cerr << "Error: Failed to unpack " << capturePath << " into " << replayDir << std::endl;
+        return 1;
+    }
+    if (errorOutput > 0) {
+        std::cerr << "Error: A section reported errors while replaying " << capturePath
+                  << "; rerun it with --proc-root to see them" << std::endl;
+        return 1;
+    }
+
+    // The banner goes to stderr so that stdout is plain CSV
+    std::cerr << "Replayed " << snapshots.size() << " snapshots x " << iterations << " iterations from "
+              << capturePath << " (checksum " << checksum << ")" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "section,ns_per_op" << std::endl;
+    std::cout << "A," << sectionA << std::endl;
+    std::cout << "cpuinfo," << cpuinfo << std::endl;
+    std::cout << "B," << sectionB << std::endl;
+    std::cout << "C," << sectionC << std::endl;
+    std::cout << "D," << sectionD << std::endl;
+    std::cout << "E," << sectionE << std::endl;
+    std::cout << "F," << sectionF << std::endl;
+    std::cout << "utilization," << cpuUtilization << std::endl;
+    std::cout << "memory_rates," << memoryRates << std::endl;
+    return 0;
+}
+
+// Function to find the entry for a pid, inserting an empty one if it is missing
+PidTable::Entry& PidTable::findOrInsert(int pid, bool& inserted) {
+    // Keep the load (including tombstones) at or below one half
+    if ((live + tombstones + 1) * 2 > slots.size()) {
+        rehash(live * 4 > slots.size() ? slots.size() * 2 : slots.size());
+    }
+
+    size_t mask = slots.size() - 1;
+    size_t slot = (static_cast<uint32_t>(pid) * 2654435761u) & mask;
+    Entry* firstTombstone = nullptr;
+    while (slots[slot].pid != EmptyPid) {
+        if (slots[slot].pid == pid) {
+            inserted = false;
+            return slots[slot];
+        }
+        if (slots[slot].pid == TombstonePid && firstTombstone == nullptr) {
+            firstTombstone = &slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    Entry* entry = &slots[slot];
+    if (firstTombstone != nullptr) {
+        entry = firstTombstone;
+        tombstones--;
+    }
+    *entry = Entry{pid, 0, 0, 0};
+    live++;
+    inserted = true;
+    return *entry;
+}
+
+// Function to turn the entries not seen in a scan into tombstones
+void PidTable::sweep(uint32_t generation) {
+    for (Entry& entry : slots) {
+        if (entry.pid > 0 && entry.generation != generation) {
+            entry.pid = TombstonePid;
+            live--;
+            tombstones++;
+        }
+    }
+}
+
+// Function to rebuild the table without tombstones; capacity is a power of two
+void PidTable::rehash(size_t capacity) {
+    std::vector<Entry> old(capacity, Entry{EmptyPid, 0, 0, 0});
+    old.swap(slots);
+    live = 0;
+    tombstones = 0;
+
+    size_t mask = slots.size() - 1;
+    for (const Entry& entry : old) {
+        if (entry.pid > 0) {
+            size_t slot = (static_cast<uint32_t>(entry.pid) * 2654435761u) & mask;
+            while (slots[slot].pid != EmptyPid) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = entry;
+            live++;
+        }
+    }
+}
+
+// Function to start the worker threads of a scan pool
+ScanPool::ScanPool(int numThreads) {
+    // Workers inherit a mask without SIGUSR1, so a report request always interrupts the main thread's sleep
+    sigset_t blocked, previous;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    for (int i = 1; i < numThreads; ++i) {
+        workers.emplace_back(&ScanPool::workerLoop, this);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+// Function to stop and join the worker threads of a scan pool
+ScanPool::~ScanPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// Function to run a task over [0, count) on every thread of the pool
+void ScanPool::run(size_t count, void (*task)(void*, size_t, size_t), void* context) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = task;
+        this->context = context;
+        this->count = count;
+        nextIndex.store(0, std::memory_order_relaxed);
+        busyWorkers = static_cast<int>(workers.size());
+        round++;
+    }
+    wake.notify_all();
+
+    drain();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busyWorkers == 0; });
+}
+
+// Function to take chunks from the shared counter until none are left
+void ScanPool::drain() {
+    while (true) {
+        size_t begin = nextIndex.fetch_add(ChunkSize, std::memory_order_relaxed);
+        if (begin >= count) {
+            return;
+        }
+        task(context, begin, std::min(begin + ChunkSize, count));
+    }
+}
+
+// Function run by each worker thread: wait for a round, drain it, report back
+void ScanPool::workerLoop() {
+    uint64_t seenRound = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || round != seenRound; });
+            if (stopping) {
+                return;
+            }
+            seenRound = round;
+        }
+
+        drain();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+// Read a whole small file relative to a directory descriptor into buf
+static ssize_t readFileAt(int dirFd, const char* relativePath, char* buf, size_t bufSize) {
+    int fd = instrumentedOpenAt(dirFd, relativePath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t bytesRead = instrumentedRead(fd, buf, bufSize - 1);
+    instrumentedClose(fd);
+    if (bytesRead >= 0) {
+        buf[bytesRead] = '\0';
+    }
+    return bytesRead;
+}
+
+// Function to read one process from /proc/[pid]/stat and /proc/[pid]/statm
+bool readProcess(int procFd, int pid, ProcessRecord& record) {
+    record.valid = false;
+    record.pid = pid;
+
+    char path[32];
+    char buf[1024];
+    snprintf(path, sizeof(path), "%d/stat", pid);
+    if (readFileAt(procFd, path, buf, sizeof(buf)) <= 0) {
+        return false;  // the process exited between readdir and open
+    }
+
+    // "pid (comm) state ppid ..."; comm may itself contain spaces and parentheses
+    const char* open = strchr(buf, '(');
+    const char* close = strrchr(buf, ')');
+    if (open == nullptr || close == nullptr || close < open || close[1] == '\0') {
+        return false;
+    }
+    copyField(record.comm, sizeof(record.comm), open + 1, close - open - 1);
+    record.state = close[2];
+
+    // Field 3 is the state; utime and stime are fields 14 and 15, starttime is field 22
+    char* cursor = const_cast<char*>(close) + 3;
+    uint64_t utime = 0;
+    uint64_t stime = 0;
+    for (int field = 4; field <= 22 && *cursor != '\0'; ++field) {
+        uint64_t value = strtoull(cursor, &cursor, 10);
+        if (field == 14) {
+            utime = value;
+        } else if (field == 15) {
+            stime = value;
+        } else if (field == 22) {
+            record.startTime = value;
+        }
+    }
+    record.cpuTicks = utime + stime;
+
+    // statm: "size resident shared text lib data dt", in pages
+    snprintf(path, sizeof(path), "%d/statm", pid);
+    if (readFileAt(procFd, path, buf, sizeof(buf)) <= 0) {
+        return false;
+    }
+    char* statm = buf;
+    strtoull(statm, &statm, 10);
+    record.rssPages = strtoull(statm, nullptr, 10);
+
+    record.valid = true;
+    return true;
+}
+
+// Work shared by the scan pool threads for one scan
+struct ProcessScan {
+    int procFd;
+    const std::vector<int>* pids;
+    std::vector<ProcessRecord>* records;
+};
+
+// Read the processes of one chunk of the pid list
+static void scanProcessChunk(void* context, size_t begin, size_t end) {
+    ProcessScan* scan = static_cast<ProcessScan*>(context);
+    for (size_t i = begin; i < end; ++i) {
+        readProcess(scan->procFd, (*scan->pids)[i], (*scan->records)[i]);
+    }
+}
+
+// Function to print the top-N processes by CPU and by RSS every interval
+int runProcessMode(const SamplingOptions& options) {
+    int procFd = ::open(procRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (procFd == -1) {
+        std::cerr << "Error: Failed to open directory " << procRoot << std::endl;
+        return 1;
+    }
+
+    int numThreads = options.scanThreads;
+    if (numThreads <= 0) {
+        numThreads = static_cast<int>(std::min(8u, std::max(1u, std::thread::hardware_concurrency())));
+    }
+    ScanPool pool(numThreads);
+
+    const double ticksPerSecond = static_cast<double>(sysconf(_SC_CLK_TCK));
+    const double pageSizeMb = sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+    const size_t topN = static_cast<size_t>(options.topN);
+
+    // Reused from scan to scan
+    std::vector<int> pids;
+    std::vector<ProcessRecord> records;
+    std::vector<const ProcessRecord*> ranked;
+    PidTable table;
+    OutputBuffer out;
+    uint32_t generation = 0;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    struct timespec previousScan = deadline;
+    long intervalNs = static_cast<long>(options.intervalSeconds * 1e9);
+
+    // Scan number 0 only primes the table so the first printed scan has CPU deltas
+    for (long scanNumber = 0; options.count == 0 || scanNumber <= options.count; ++scanNumber) {
+        if (scanNumber > 0) {
+            sleepUntilNextInterval(deadline, intervalNs);
+        }
+
+        ScopedProbe probe(ProbeProcessScan);
+        struct timespec scanStart;
+        clock_gettime(CLOCK_MONOTONIC, &scanStart);
+
+        // List the numeric entries of /proc
+        pids.clear();
+        int listFd = dup(procFd);
+        DIR* dir = listFd != -1 ? fdopendir(listFd) : nullptr;
+        if (dir == nullptr) {
+            std::cerr << "Error: Failed to list " << procRoot << std::endl;
+            close(procFd);
+            return 1;
+        }
+        rewinddir(dir);
+        while (struct dirent* entry = readdir(dir)) {
+            if (isdigit(static_cast<unsigned char>(entry->d_name[0]))) {
+                pids.push_back(atoi(entry->d_name));
+            }
+        }
+        closedir(dir);
+
+        // Read every process on the pool
+        records.resize(pids.size());
+        ProcessScan scan{procFd, &pids, &records};
+        pool.run(pids.size(), scanProcessChunk, &scan);
+
+        struct timespec scanEnd;
+        clock_gettime(CLOCK_MONOTONIC, &scanEnd);
+        double elapsedSeconds = (scanStart.tv_sec - previousScan.tv_sec) + (scanStart.tv_nsec - previousScan.tv_nsec) / 1e9;
+        double scanMs = (scanEnd.tv_sec - scanStart.tv_sec) * 1e3 + (scanEnd.tv_nsec - scanStart.tv_nsec) / 1e6;
+        previousScan = scanStart;
+
+        // CPU deltas against the previous scan; a reused pid starts over
+        generation++;
+        size_t numValid = 0;
+        for (ProcessRecord& record : records) {
+            if (!record.valid) {
+                continue;
+            }
+            numValid++;
+            bool inserted = false;
+            PidTable::Entry& entry = table.findOrInsert(record.pid, inserted);
+            if (inserted || entry.startTime != record.startTime || scanNumber == 0) {
+                record.cpuPercent = 0.0f;
+            } else {
+                record.cpuPercent = static_cast<float>((record.cpuTicks - entry.cpuTicks) / ticksPerSecond /
+                                                       elapsedSeconds * 100.0);
+            }
+            entry.generation = generation;
+            entry.startTime = record.startTime;
+            entry.cpuTicks = record.cpuTicks;
+        }
+        table.sweep(generation);
+
+        if (scanNumber == 0) {
+            continue;
+        }
+
+        // Rank by CPU, then by RSS, and write both tables with one write(2)
+        ranked.clear();
+        for (const ProcessRecord& record : records) {
+            if (record.valid) {
+                ranked.push_back(&record);
+            }
+        }
+        size_t shown = std::min(topN, ranked.size());
+
+        out.appendf("scan %ld: %zu processes in %.2f ms on %d threads\n", scanNumber, numValid, scanMs, pool.size());
+
+        std::partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end(),
+                          [](const ProcessRecord* a, const ProcessRecord* b) { return a->cpuPercent > b->cpuPercent; });
+        out.appendf("  top %zu by CPU:\n  %7s %6s %10s %s\n", shown, "PID", "CPU%", "RSS MB", "COMMAND");
+        for (size_t i = 0; i < shown; ++i) {
+            out.appendf("  %7d %6.1f %10.1f %s\n", ranked[i]->pid, ranked[i]->cpuPercent,
+                        ranked[i]->rssPages * pageSizeMb, ranked[i]->comm);
+        }
+
+        std::partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end(),
+                          [](const ProcessRecord* a, const ProcessRecord* b) { return a->rssPages > b->rssPages; });
+        out.appendf("  top %zu by RSS:\n  %7s %6s %10s %s\n", shown, "PID", "CPU%", "RSS MB", "COMMAND");
+        for (size_t i = 0; i < shown; ++i) {
+            out.appendf("  %7d %6.1f %10.1f %s\n", ranked[i]->pid, ranked[i]->cpuPercent,
+                        ranked[i]->rssPages * pageSizeMb, ranked[i]->comm);
+        }
+
+        if (!out.flushTo(STDOUT_FILENO)) {
+            std::cerr << "Error: Failed to write scan " << scanNumber << std::endl;
+            close(procFd);
+            return 1;
+        }
+    }
+
+    close(procFd);
+    return 0;
+}
+
+// Function to allocate every slot of a sample ring up front
+SampleRing::SampleRing(size_t capacity, size_t maxCpus)
+    : numSlots(capacity), cpusPerSlot(maxCpus), slots(new Slot[capacity]),
+      cpuIds(capacity * maxCpus), busy(capacity * maxCpus) {
+}
+
+// Function to publish a sample into the next slot of the ring
+void SampleRing::publish(long sampleNumber, const Sample& sample) {
+    uint64_t index = head.load(std::memory_order_relaxed);
+    size_t slotIndex = index % numSlots;
+    Slot& slot = slots[slotIndex];
+
+    // An odd sequence tells readers the slot is being written
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    RingRecord& record = slot.record;
+    record.sampleNumber = static_cast<uint64_t>(sampleNumber);
+    record.timestampNs = sample.timestampNs;
+    record.uptimeSeconds = sample.uptimeSeconds;
+    record.hasSwap = sample.hasSwap;
+    record.swapSizeMb = sample.swapSizeMb;
+    record.hasCpu5 = sample.hasCpu5;
+    record.cpu5 = sample.cpu5;
+    record.numCpus = static_cast<uint32_t>(std::min(sample.utilization.numCpus, cpusPerSlot));
+    if (record.numCpus > 0) {
+        memcpy(&cpuIds[slotIndex * cpusPerSlot], sample.cpuStat.cpuIds.data(), record.numCpus * sizeof(uint32_t));
+        memcpy(&busy[slotIndex * cpusPerSlot], sample.utilization.busy.data(), record.numCpus * sizeof(float));
+    }
+
+    // The even sequence 2 * (index + 1) marks sample index as complete
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+    head.store(index + 1, std::memory_order_release);
+}
+
+// Function to copy one published sample out of the ring without writing to it
+bool SampleRing::read(uint64_t index, RingRecord& record, uint32_t* outCpuIds, float* outBusy) const {
+    size_t slotIndex = index % numSlots;
+    const Slot& slot = slots[slotIndex];
+
+    uint64_t before = slot.sequence.load(std::memory_order_acquire);
+    if (before != 2 * index + 2) {
+        return false;
+    }
+
+    record = slot.record;
+    size_t numCpus = std::min<size_t>(record.numCpus, cpusPerSlot);
+    memcpy(outCpuIds, &cpuIds[slotIndex * cpusPerSlot], numCpus * sizeof(uint32_t));
+    memcpy(outBusy, &busy[slotIndex * cpusPerSlot], numCpus * sizeof(float));
+
+    // If the sampler started rewriting the slot meanwhile, the copy may be torn
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == before;
+}
+
+// Function to set up a query server for a ring
+QueryServer::QueryServer(const SampleRing& ring, const std::string& socketPath)
+    : ring(ring), socketPath(socketPath), cpuIds(ring.maxCpus()), busy(ring.maxCpus()) {
+}
+
+// Function to stop the server thread and remove the socket
+QueryServer::~QueryServer() {
+    stopping.store(true);
+    if (thread.joinable()) {
+        thread.join();
+    }
+    if (listenFd != -1) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+}
+
+// Function to bind the query socket and start the server thread
+bool QueryServer::start() {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: Socket path is too long: " << socketPath << std::endl;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd == -1) {
+        std::cerr << "Error: Failed to create socket" << std::endl;
+        return false;
+    }
+
+    // Replace a stale socket left by an earlier run
+    unlink(socketPath.c_str());
+    if (bind(listenFd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1 ||
+        listen(listenFd, 16) == -1) {
+        std::cerr << "Error: Failed to listen on " << socketPath << std::endl;
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    // A client that hangs up early must not kill the sampler
+    signal(SIGPIPE, SIG_IGN);
+
+    // Keep SIGUSR1 on the sampling thread, as for the scan workers
+    sigset_t blocked, previous;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    thread = std::thread(&QueryServer::serve, this);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return true;
+}
+
+// Function run by the server thread: accept clients until stopped
+void QueryServer::serve() {
+    while (!stopping.load()) {
+        struct pollfd listener = {listenFd, POLLIN, 0};
+        if (poll(&listener, 1, 200) <= 0) {
+            continue;
+        }
+        int clientFd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (clientFd != -1) {
+            handleClient(clientFd);
+            close(clientFd);
+        }
+    }
+}
+
+// Function to read one request line from a client and write the answer
+void QueryServer::handleClient(int clientFd) {
+    char request[256];
+    size_t length = 0;
+    while (length < sizeof(request) - 1) {
+        struct pollfd client = {clientFd, POLLIN, 0};
+        if (poll(&client, 1, 1000) <= 0) {
+            return;
+        }
+        ssize_t bytesRead = read(clientFd, request + length, sizeof(request) - 1 - length);
+        if (bytesRead <= 0) {
+            break;
+        }
+        length += static_cast<size_t>(bytesRead);
+        if (memchr(request, '\n', length) != nullptr) {
+            break;
+        }
+    }
+    request[length] = '\0';
+    request[strcspn(request, "\r\n")] = '\0';
+
+    OutputBuffer out;
+    answer(request, out);
+    out.flushTo(clientFd);
+}
+
+// Function to answer one request:
+//   current           the latest sample
+//   swap              the latest swap size in MB
+//   cpu N SECONDS     busy% of cpu N for every sample in the last SECONDS
+void QueryServer::answer(const char* request, OutputBuffer& out) {
+    uint64_t published = ring.published();
+    RingRecord latest;
+    bool haveLatest = false;
+    while (published > 0 && !haveLatest) {
+        haveLatest = ring.read(published - 1, latest, cpuIds.data(), busy.data());
+        if (!haveLatest) {
+            published = ring.published();
+        }
+    }
+
+    int cpu = -1;
+    double seconds = 0.0;
+    if (strcmp(request, "current") == 0) {
+        if (!haveLatest) {
+            out.appendf("error: no samples yet\n");
+            return;
+        }
+        out.appendf("sample %llu timestamp_ns %llu uptime_s %.2f", static_cast<unsigned long long>(latest.sampleNumber),
+                    static_cast<unsigned long long>(latest.timestampNs), latest.uptimeSeconds);
+        if (latest.hasSwap) {
+            out.appendf(" swap_mb %.2f", latest.swapSizeMb);
+        }
+        if (latest.hasCpu5) {
+            out.appendf(" cpu5_user_ticks %llu cpu5_system_ticks %llu cpu5_idle_ticks %llu",
+                        static_cast<unsigned long long>(latest.cpu5.user),
+                        static_cast<unsigned long long>(latest.cpu5.system),
+                        static_cast<unsigned long long>(latest.cpu5.idle));
+        }
+        out.append("\n", 1);
+    } else if (strcmp(request, "swap") == 0) {
+        if (!haveLatest || !latest.hasSwap) {
+            out.appendf("error: no swap sample\n");
+            return;
+        }
+        out.appendf("%.2f\n", latest.swapSizeMb);
+    } else if (sscanf(request, "cpu %d %lf", &cpu, &seconds) == 2 && cpu >= 0 && seconds > 0.0) {
+        if (!haveLatest) {
+            out.appendf("error: no samples yet\n");
+            return;
+        }
+        uint64_t cutoffNs = latest.timestampNs - std::min<uint64_t>(latest.timestampNs, static_cast<uint64_t>(seconds * 1e9));
+
+        // Walk back to the oldest sample still in the window, then print oldest first
+        uint64_t first = published;
+        RingRecord record;
+        while (first > 0 && published - first < ring.capacity() &&
+               ring.read(first - 1, record, cpuIds.data(), busy.data()) && record.timestampNs >= cutoffNs) {
+            first--;
+        }
+        size_t printed = 0;
+        for (uint64_t index = first; index < published; ++index) {
+            if (!ring.read(index, record, cpuIds.data(), busy.data())) {
+                continue;
+            }
+            for (uint32_t i = 0; i < record.numCpus; ++i) {
+                if (cpuIds[i] == static_cast<uint32_t>(cpu)) {
+                    out.appendf("%llu %.1f\n", static_cast<unsigned long long>(record.timestampNs), busy[i]);
+                    printed++;
+                }
+            }
+        }
+        if (printed == 0) {
+            out.appendf("error: no samples for cpu %d\n", cpu);
+        }
+    } else {
+        out.appendf("error: unknown request; use \"current\", \"swap\" or \"cpu N SECONDS\"\n");
+    }
+}
+
+// Function to send one request to a --serve socket and print the answer
+int runQueryClient(const std::string& socketPath, const std::string& request) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: Socket path is too long: " << socketPath << std::endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) {
+        std::cerr << "Error: Failed to connect to " << socketPath << std::endl;
+        if (fd != -1) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    std::string line = request + "\n";
+    if (write(fd, line.data(), line.size()) != static_cast<ssize_t>(line.size())) {
+        std::cerr << "Error: Failed to send request" << std::endl;
+        close(fd);
+        return 1;
+    }
+
+    char buf[4096];
+    ssize_t bytesRead;
+    while ((bytesRead = read(fd, buf, sizeof(buf))) > 0) {
+        std::cout.write(buf, bytesRead);
+    }
+    close(fd);
+    return 0;
+}
+
+// Process-wide counters of the system calls made through the instrumented wrappers
+static std::atomic<uint64_t> openCalls{0};
+static std::atomic<uint64_t> readCalls{0};
+static std::atomic<uint64_t> closeCalls{0};
+
+// Per-probe wall time (ns) and syscalls-per-call histograms, plus syscall totals
+struct ProbeStats {
+    LogHistogram wallNs;
+    LogHistogram syscalls;
+    uint64_t opens = 0;
+    uint64_t reads = 0;
+    uint64_t closes = 0;
+};
+static ProbeStats probeStats[NumProbes];
+static const char* const probeNames[NumProbes] = {
+    "sectionA", "sectionB", "sectionC", "sectionD", "sectionE", "sectionF",
+    "parseCpuInfo", "sample", "processScan"
+};
+
+// When instrumentation started, for the report's wall time and CPU share
+static struct timespec programStart;
+static double programStartCpuSeconds = 0.0;
+
+// Function to return the user plus system CPU time used by the process so far
+static double processCpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Set by the SIGUSR1 handler, cleared when the report is printed
+static volatile sig_atomic_t selfStatsRequested = 0;
+
+// Function to map a value to its histogram bucket
+size_t LogHistogram::bucketOf(uint64_t value) {
+    if (value < SubBuckets) {
+        return static_cast<size_t>(value);
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - SubBucketBits;
+    size_t subBucket = static_cast<size_t>(value >> shift) - SubBuckets;
+    return SubBuckets + static_cast<size_t>(shift) * SubBuckets + subBucket;
+}
+
+// Function to return the largest value that falls into a histogram bucket
+uint64_t LogHistogram::bucketUpperBound(size_t bucket) {
+    if (bucket < SubBuckets) {
+        return bucket;
+    }
+    size_t shift = (bucket - SubBuckets) / SubBuckets;
+    uint64_t subBucket = (bucket - SubBuckets) % SubBuckets;
+    uint64_t lower = (SubBuckets + subBucket) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+// Function to record one value in a histogram
+void LogHistogram::record(uint64_t value) {
+    counts[bucketOf(value)]++;
+    total++;
+    maxValue = std::max(maxValue, value);
+}
+
+// Function to find the bucket holding a percentile of the recorded values
+uint64_t LogHistogram::percentile(double p) const {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * total));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < NumBuckets; ++bucket) {
+        seen += counts[bucket];
+        if (seen >= rank && counts[bucket] > 0) {
+            return std::min(bucketUpperBound(bucket), maxValue);
+        }
+    }
+    return maxValue;
+}
+
+// Function to start timing a probe
+ScopedProbe::ScopedProbe(Probe probe)
+    : probe(probe),
+      opensAtStart(openCalls.load(std::memory_order_relaxed)),
+      readsAtStart(readCalls.load(std::memory_order_relaxed)),
+      closesAtStart(closeCalls.load(std::memory_order_relaxed)) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+// Function to record a probe's wall time and syscall counts
+ScopedProbe::~ScopedProbe() {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t elapsedNs = static_cast<uint64_t>((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec));
+
+    uint64_t opens = openCalls.load(std::memory_order_relaxed) - opensAtStart;
+    uint64_t reads = readCalls.load(std::memory_order_relaxed) - readsAtStart;
+    uint64_t closes = closeCalls.load(std::memory_order_relaxed) - closesAtStart;
+
+    ProbeStats& stats = probeStats[probe];
+    stats.wallNs.record(elapsedNs);
+    stats.syscalls.record(opens + reads + closes);
+    stats.opens += opens;
+    stats.reads += reads;
+    stats.closes += closes;
+}
+
+// Function to open a file and count the call
+int instrumentedOpen(const char* path, int flags) {
+    openCalls.fetch_add(1, std::memory_order_relaxed);
+    return ::open(path, flags);
+}
+
+// Function to open a file relative to a directory and count the call
+int instrumentedOpenAt(int dirFd, const char* path, int flags) {
+    openCalls.fetch_add(1, std::memory_order_relaxed);
+    return openat(dirFd, path, flags);
+}
+
+// Function to read from a file and count the call
+ssize_t instrumentedRead(int fd, void* buf, size_t count) {
+    readCalls.fetch_add(1, std::memory_order_relaxed);
+    return read(fd, buf, count);
+}
+
+// Function to read from a file at an offset and count the call
+ssize_t instrumentedPread(int fd, void* buf, size_t count, off_t offset) {
+    readCalls.fetch_add(1, std::memory_order_relaxed);
+    return pread(fd, buf, count, offset);
+}
+
+// Function to close a file and count the call
+int instrumentedClose(int fd) {
+    closeCalls.fetch_add(1, std::memory_order_relaxed);
+    return close(fd);
+}
+
+// Function to print per-probe p50/p99/max and syscall counts, plus the tool's own CPU use
+void printSelfStats() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wallSeconds = (now.tv_sec - programStart.tv_sec) + (now.tv_nsec - programStart.tv_nsec) / 1e9;
+
+    double cpuSeconds = processCpuSeconds() - programStartCpuSeconds;
+
+    OutputBuffer out;
+    out.appendf("self-instrumentation: %.3f s wall, %.3f s cpu (%.2f%% of one core)\n", wallSeconds, cpuSeconds,
+                wallSeconds > 0.0 ? cpuSeconds / wallSeconds * 100.0 : 0.0);
+    out.appendf("%-13s %8s %10s %10s %10s %8s %8s %8s %13s\n", "probe", "calls", "p50_us", "p99_us", "max_us",
+                "opens", "reads", "closes", "syscalls_p99");
+    for (int probe = 0; probe < NumProbes; ++probe) {
+        const ProbeStats& stats = probeStats[probe];
+        if (stats.wallNs.count() == 0) {
+            continue;
+        }
+        out.appendf("%-13s %8llu %10.1f %10.1f %10.1f %8llu %8llu %8llu %13llu\n", probeNames[probe],
+                    static_cast<unsigned long long>(stats.wallNs.count()), stats.wallNs.percentile(50) / 1e3,
+                    stats.wallNs.percentile(99) / 1e3, stats.wallNs.max() / 1e3,
+                    static_cast<unsigned long long>(stats.opens), static_cast<unsigned long long>(stats.reads),
+                    static_cast<unsigned long long>(stats.closes),
+                    static_cast<unsigned long long>(stats.syscalls.percentile(99)));
+    }
+    out.flushTo(STDERR_FILENO);
+}
+
+// Record a report request; the report itself is printed outside the handler
+static void handleSelfStatsSignal(int) {
+    selfStatsRequested = 1;
+}
+
+// Function to install the SIGUSR1 handler and start the self-instrumentation clock
+void installSelfStatsSignal() {
+    // Without SA_RESTART, a signal interrupts the interval sleep so the report is prompt
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleSelfStatsSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, nullptr);
+
+    clock_gettime(CLOCK_MONOTONIC, &programStart);
+    programStartCpuSeconds = processCpuSeconds();
+}
+
+// Function to print the report if SIGUSR1 arrived since the last call
+void serviceSelfStatsRequest() {
+    if (selfStatsRequested) {
+        selfStatsRequested = 0;
+        printSelfStats();
+    }
+}
+
+// Function to sleep until the next interval deadline, serving report requests meanwhile
+void sleepUntilNextInterval(struct timespec& deadline, long intervalNs) {
+    deadline.tv_sec += intervalNs / 1000000000L;
+    deadline.tv_nsec += intervalNs % 1000000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+        serviceSelfStatsRequest();
+    }
+    serviceSelfStatsRequest();
+}
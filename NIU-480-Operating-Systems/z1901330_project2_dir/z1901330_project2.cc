@@ -8,276 +8,3758 @@ Purpose: Practice the use of fork() and several other system calls to implementa
 *********************************************************************/
 
 #include <iostream>
+#include <fstream>
+#include <iomanip>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 
+/**
+ * Splits a line of user input into tokens on whitespace. A '|' or '&' is always a token of its own,
+ * so "ls|wc" and "ls | wc" tokenize the same way.
+ *
+ * @param line The line of user input.
+ * @return The tokens, in order.
+ */
+std::vector<std::string> tokenize_line(const std::string& line);
+
+/**
+ * Splits command tokens into pipeline stages at each '|' token.
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ * @param stages Receives the tokens of each stage, in pipeline order.
+ * @return false if a stage is empty (e.g. "ls |" or "| wc"), true otherwise.
+ */
+bool split_pipeline(const std::vector<std::string>& tokens, std::vector<std::vector<std::string>>& stages);
+
+/**
+ * How external programs are started: fork() then execvp() in the child, or posix_spawnp(),
+ * which glibc implements with clone(CLONE_VM | CLONE_VFORK) so the parent's page tables
+ * are never copied. Splice builtins always fork, since they have nothing to exec.
+ */
+enum class launch_mode { fork_exec, spawn };
+
+/**
+ * The launch mode used by execute_command(), switched with the 'launch' builtin.
+ */
+launch_mode current_launch_mode = launch_mode::spawn;
+
+/**
+ * A pipeline started by execute_command(), tracked in the job table until every one of its
+ * processes has been reaped.
+ */
+struct job {
+    std::string command;     // The command line, for reports
+    std::vector<pid_t> pids; // One process per pipeline stage that could be started
+    pid_t last_pid = -1;     // The final stage, whose exit status is the job's
+    size_t running = 0;      // Processes not reaped yet
+    int status = 0;          // Wait status of the final stage
+    bool background = false; // Started with a trailing '&'
+    struct timespec start_time = {0, 0}; // CLOCK_MONOTONIC when the job was started
+    struct timespec end_time = {0, 0};   // CLOCK_MONOTONIC when its last process was reaped
+    struct rusage usage = {};            // Summed over the processes reaped so far; ru_maxrss is the largest
+};
+
+/**
+ * All unfinished jobs, plus background jobs that finished but were not reported yet, by job number.
+ */
+std::map<int, job> job_table;
+
+/**
+ * Readable when a child has changed state. SIGCHLD is blocked in the shell and delivered here instead.
+ */
+int child_signal_fd = -1;
+
+/**
+ * The resources one finished command used, as reported by 'time' and the stats mode.
+ */
+struct command_stats {
+    std::string command;  // The command line; empty if no foreground command has finished yet
+    int status = 0;       // Wait status of the final stage
+    double wall_ms = 0.0; // From start to the last process being reaped
+    struct rusage usage = {};
+};
+
+/**
+ * The foreground job that wait_for_job() finished most recently.
+ */
+command_stats last_command;
+
+/**
+ * When set (with 'stats on'), every foreground command is reported as 'time' would, and kept
+ * for the session summary.
+ */
+bool stats_mode = false;
+
+/**
+ * Every command reported by 'time' or the stats mode this session.
+ */
+std::vector<command_stats> session_stats;
+
+/**
+ * Adds one child's resource usage to a job's running total.
+ *
+ * @param total The total; ru_maxrss becomes the larger of the two.
+ * @param child The child's usage, from wait4().
+ */
+void add_rusage(struct rusage& total, const struct rusage& child);
+
+/**
+ * Runs a command and then reports its wall, user and system time, peak RSS, page faults and
+ * context switches on stderr (the 'time' builtin).
+ *
+ * @param tokens A vector of strings representing the command tokens, starting with "time".
+ */
+void time_command(const std::vector<std::string>& tokens);
+
+/**
+ * The 'stats' builtin: 'stats on' and 'stats off' switch the stats mode, and 'stats' alone
+ * prints the session summary.
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ */
+void stats_command(const std::vector<std::string>& tokens);
+
+/**
+ * Prints one finished command's resource usage on stderr and adds it to the session summary.
+ *
+ * @param stats The command.
+ */
+void report_command_stats(const command_stats& stats);
+
+/**
+ * Prints the totals of the commands reported this session and the slowest of them on stderr.
+ */
+void print_session_summary();
+
+/**
+ * Blocks SIGCHLD and opens child_signal_fd, so finished children are reaped by reap_children().
+ */
+void init_child_signals();
+
+/**
+ * Reaps every child that has exited and updates its job. Never blocks.
+ */
+void reap_children();
+
+/**
+ * Sleeps until some child changes state, then reaps every child that has exited.
+ */
+void wait_for_child_event();
+
+/**
+ * Waits until every process of a job has exited and removes the job from the table.
+ *
+ * @param job_id The job number.
+ * @return The wait status of the job's final stage.
+ */
+int wait_for_job(int job_id);
+
+/**
+ * Prints and removes the background jobs that finished since the last prompt.
+ */
+void report_finished_jobs();
+
+/**
+ * Waits until a line can be read from an interactive terminal, reaping children as they exit.
+ */
+void wait_for_input();
+
+/**
+ * Lists the background jobs (the 'jobs' builtin). Finished jobs are removed once listed.
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ */
+void jobs_command(const std::vector<std::string>& tokens);
+
+/**
+ * Waits for one background job, or all of them, and reports each (the 'wait' and 'fg' builtins;
+ * 'fg' takes the most recent job by default and does not report it as Done).
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ */
+void wait_command(const std::vector<std::string>& tokens);
+
+/**
+ * Starts a pipeline as a new job without waiting for it.
+ *
+ * @param command_tokens The command tokens, without a trailing '&'.
+ * @param background Whether the job runs in the background; its input is then /dev/null.
+ * @param status Receives the failure status if no process could be started.
+ * @return The new job number, or 0 if nothing was started.
+ */
+int start_job(const std::vector<std::string>& command_tokens, bool background, int& status);
+
+/**
+ * Runs the commands of a script, one per line, with up to 'workers' of them running at once
+ * (myshell -j N script). Blank lines and lines starting with '#' are skipped. Prints a summary
+ * of each command's exit status and wall time when all have finished.
+ *
+ * @param workers The number of commands to keep running concurrently.
+ * @param script_path The script to run.
+ * @return EXIT_SUCCESS if every command exited with status 0, EXIT_FAILURE otherwise.
+ */
+int run_batch(int workers, const std::string& script_path);
+
 /**
  * Executes a command specified by a vector of strings representing tokens.
+ * The command may be a pipeline of stages joined by '|'; all stages are started
+ * before any of them is waited for. A trailing '&' runs it as a background job.
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ * @return The wait status of the final stage, or 0 for a background job.
+ */
+int execute_command(const std::vector<std::string>& tokens);
+
+/**
+ * Checks whether a pipeline stage is handled by the shell's own splice()-based data mover
+ * instead of an external program: "cat" with no operands, or "tee" with exactly one file.
+ *
+ * @param stage The tokens of one pipeline stage.
+ * @return true if the stage is run by run_splice_builtin().
+ */
+bool is_splice_builtin(const std::vector<std::string>& stage);
+
+/**
+ * Runs a splice builtin in a pipeline child, copying standard input to standard output
+ * (and to the file, for tee) with splice(2)/tee(2) so the data never enters user space.
+ * Falls back to read()/write() when neither end is a pipe.
+ *
+ * @param stage The tokens of one pipeline stage, accepted by is_splice_builtin().
+ * @return The exit status for the child.
+ */
+int run_splice_builtin(const std::vector<std::string>& stage);
+
+/**
+ * Starts one pipeline stage as a child process.
+ *
+ * @param stage The tokens of the stage, including any '>' redirection.
+ * @param in_fd The descriptor to use as standard input, or -1 to inherit the shell's.
+ * @param out_fd The descriptor to use as standard output, or -1 to inherit the shell's.
+ * @param pipe_fds Every pipe end of the pipeline, closed in the child (fork path only;
+ *                 the spawn path relies on their O_CLOEXEC flag).
+ * @param mode Whether to fork and exec, or to posix_spawn.
+ * @return The child's pid, or -1 if it could not be started.
+ */
+pid_t launch_stage(const std::vector<std::string>& stage, int in_fd, int out_fd, const std::vector<int>& pipe_fds,
+                   launch_mode mode);
+
+/**
+ * Builds the NULL-terminated argument list for a stage, stopping at the first '>' token.
+ *
+ * @param stage The tokens of one pipeline stage.
+ * @return Pointers into the stage's strings, followed by nullptr.
+ */
+std::vector<char*> build_args(const std::vector<std::string>& stage);
+
+/**
+ * Finds the file named by a redirection operator '>' in the tokens, either as ">file" or "> file".
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ * @param output_file Receives the file name, or is left empty if there is no redirection.
+ * @return false (after printing an error) if '>' is not followed by a file name, true otherwise.
+ */
+bool find_output_file(const std::vector<std::string>& tokens, std::string& output_file);
+
+/**
+ * Redirects program output to a specified file if a redirection operator '>' is found in the tokens.
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ */
+void redirect_output(const std::vector<std::string>& tokens);
+
+/**
+ * Measures launch latency and throughput of the fork/exec and posix_spawn paths by running
+ * 'true' repeatedly. Usage: spawnbench [launches] [ballast_mb], where ballast_mb grows the
+ * shell's resident set first, to show how fork() slows down with parent size.
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ */
+void spawn_benchmark(const std::vector<std::string>& tokens);
+
+
+/**
+ * Simulated time, in milliseconds. 64 bits, so sums over hundreds of millions of processes cannot overflow.
+ */
+typedef int64_t sim_time;
+
+/**
+ * A process in the scheduling simulator, as produced by a workload source.
+ */
+struct sim_process {
+    sim_time arrival; // When the process becomes ready
+    sim_time burst;   // Total CPU time it needs
+    int priority;     // Lower values are more important
+};
+
+/**
+ * A stream of processes in arrival order. The engine pulls one process at a time, so a
+ * workload never has to fit in memory.
+ */
+class workload_source {
+public:
+    virtual ~workload_source() {}
+
+    /**
+     * Produces the next process.
+     *
+     * @param process Receives the process.
+     * @return false once the workload is exhausted.
+     */
+    virtual bool next(sim_process& process) = 0;
+};
+
+/**
+ * The processes that have arrived and not yet completed, as a structure of arrays indexed
+ * by slot. A completed process's slot is reused by a later arrival, so the table only grows
+ * to the largest number of processes alive at once.
+ */
+struct process_table {
+    std::vector<int64_t> id;           // Position in the workload, from 0
+    std::vector<sim_time> arrival;
+    std::vector<sim_time> burst;
+    std::vector<sim_time> remaining;   // CPU time still needed, as of the last time it stopped running
+    std::vector<sim_time> first_run;   // When it was first dispatched, or -1
+    std::vector<sim_time> dispatched;  // When it was last dispatched
+    std::vector<int32_t> priority;
+    std::vector<int32_t> free_slots;
+
+    /**
+     * @return The number of slots, used or free.
+     */
+    size_t capacity() const { return id.size(); }
+
+    /**
+     * Stores a newly arrived process in a free slot.
+     *
+     * @param process The process.
+     * @param process_id Its position in the workload.
+     * @return The slot.
+     */
+    int allocate(const sim_process& process, int64_t process_id);
+
+    /**
+     * Frees the slot of a completed process.
+     *
+     * @param slot The slot.
+     */
+    void release(int slot) { free_slots.push_back(slot); }
+};
+
+/**
+ * A min-heap with D children per node, stored in one flat vector. With D = 4 a node's children
+ * share a cache line and the tree is half as deep as a binary heap, which makes pop() cheaper.
+ */
+template <typename T, int D = 4>
+class d_ary_heap {
+public:
+    bool empty() const { return items.empty(); }
+    size_t size() const { return items.size(); }
+    const T& top() const { return items.front(); }
+    const std::vector<T>& contents() const { return items; }
+    void clear() { items.clear(); }
+
+    /**
+     * Adds an item.
+     *
+     * @param item The item; smaller items (by operator<) come out first.
+     */
+    void push(const T& item);
+
+    /**
+     * Removes the smallest item.
+     */
+    void pop();
+
+private:
+    std::vector<T> items;
+};
+
+/**
+ * Aggregate results of simulating one workload under one policy.
+ */
+struct sim_summary {
+    int64_t processes = 0;
+    sim_time total_waiting = 0;     // Sum of completion - arrival - burst
+    sim_time total_turnaround = 0;  // Sum of completion - arrival
+    sim_time total_response = 0;    // Sum of first_run - arrival
+    sim_time makespan = 0;          // Completion time of the last process
+    int64_t context_switches = 0;   // Dispatches of a different process than the one before
+    int64_t events = 0;             // Events taken from the event list
+};
+
+/**
+ * Tunables shared by the scheduling policies.
+ */
+struct sched_options {
+    sim_time quantum = 10;  // Round-robin slice, and the MLFQ top-level slice
+    sim_time aging = 100;   // Waiting this long raises a process by one priority level
+    sim_time boost = 1000;  // MLFQ moves every process back to the top level this often
+    int mlfq_levels = 3;    // Number of MLFQ levels; level k has a slice of quantum << k
+};
+
+/**
+ * A ready-queue policy for the scheduling simulator. The engine owns the clock and the
+ * running process; the policy only decides which ready process runs next and for how long.
+ */
+class scheduler {
+public:
+    virtual ~scheduler() {}
+
+    /**
+     * @return The short name of the policy, e.g. "srtf".
+     */
+    virtual const char* name() const = 0;
+
+    /**
+     * Gives the policy read access to the process table, which the engine keeps up to date.
+     * Called once before the simulation starts.
+     */
+    void attach(const process_table& process_table) { table = &process_table; }
+
+    /**
+     * A process arrived. By default it is simply made ready.
+     *
+     * @param slot The process's slot in the table.
+     * @param now The current simulated time.
+     */
+    virtual void arrive(int slot, sim_time now) { ready(slot, now); }
+
+    /**
+     * A process became ready: it arrived, or it was preempted.
+     *
+     * @param slot The process's slot in the table.
+     * @param now The current simulated time.
+     */
+    virtual void ready(int slot, sim_time now) = 0;
+
+    /**
+     * Removes the process that should run next from the ready queue.
+     *
+     * @param now The current simulated time.
+     * @return The process's slot, or -1 if no process is ready.
+     */
+    virtual int next(sim_time now) = 0;
+
+    /**
+     * Removes a ready process for another core to run. Like a thief in a Chase-Lev work-stealing
+     * deque, it takes from the opposite end to next() where the queue has two ends; otherwise
+     * it takes the process next() would have returned.
+     *
+     * @param now The current simulated time.
+     * @return The process's slot, or -1 if no process is ready.
+     */
+    virtual int steal(sim_time now) { return next(now); }
+
+    /**
+     * A process taken from another core's queue with steal() joins this one. Unlike arrive(),
+     * it keeps the standing it had there, so that moving between cores neither promotes nor
+     * demotes it. By default it is simply made ready.
+     *
+     * @param slot The process's slot in the table.
+     * @param from The policy instance of the core it was taken from; the same policy as this one.
+     * @param now The current simulated time.
+     */
+    virtual void migrate(int slot, const scheduler& from, sim_time now) { ready(slot, now); }
+
+    /**
+     * @return The number of ready processes.
+     */
+    virtual size_t queued() const = 0;
+
+    /**
+     * @return How long the process in slot may run before it is preempted; it may finish sooner.
+     */
+    virtual sim_time slice(int slot) const { return INT64_MAX; }
+
+    /**
+     * @return Whether the newly ready process 'arriving' should take the CPU from 'running'.
+     *         The running process's remaining time is current when this is called.
+     */
+    virtual bool preempts(int arriving, int running, sim_time now) const { return false; }
+
+    /**
+     * Called when the running process loses the CPU before finishing, just before it is
+     * made ready again.
+     *
+     * @param slot The preempted process.
+     * @param slice_expired true if it used up its slice, false if an arrival preempted it.
+     */
+    virtual void preempted(int slot, bool slice_expired) {}
+
+protected:
+    const process_table* table = nullptr;
+};
+
+/**
+ * Receives per-process events from the engine, for tracing. Only called when one is given
+ * to simulate(), so an untraced run pays nothing for it.
+ */
+class sim_observer {
+public:
+    virtual ~sim_observer() {}
+
+    /**
+     * A process was given the CPU.
+     */
+    virtual void dispatched(const process_table& table, int slot, sim_time now) {}
+
+    /**
+     * A process finished; its slot is still valid during the call.
+     */
+    virtual void completed(const process_table& table, int slot, sim_time now) {}
+};
+
+/**
+ * Collects text in memory and writes it to a descriptor in large blocks, instead of
+ * flushing a stream once per line.
+ */
+class trace_buffer {
+public:
+    explicit trace_buffer(int fd) : fd(fd) {}
+    ~trace_buffer() { flush(); }
+    trace_buffer(const trace_buffer&) = delete;
+    trace_buffer& operator=(const trace_buffer&) = delete;
+
+    /**
+     * Appends printf-style formatted text, flushing first if the buffer is nearly full.
+     */
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    /**
+     * Writes out everything buffered so far.
+     */
+    void flush();
+
+private:
+    int fd;
+    std::string data;
+};
+
+/**
+ * Creates a scheduling policy by name: fcfs, sjf, srtf, prio, rr or mlfq.
+ *
+ * @param name The policy name.
+ * @param options Tunables for the policies that use them.
+ * @return The policy, or nullptr if the name is unknown.
+ */
+std::unique_ptr<scheduler> make_scheduler(const std::string& name, const sched_options& options);
+
+/**
+ * Runs a workload to completion under a scheduling policy on one CPU. The engine is driven by
+ * an event list (a d-ary heap ordered by time) holding the next arrival and the running
+ * process's completion or slice expiry.
+ *
+ * @param source The workload, in arrival order.
+ * @param policy The scheduling policy.
+ * @param observer Receives per-process events, or nullptr.
+ * @return Totals for computing the average waiting, turnaround and response times.
+ */
+sim_summary simulate(workload_source& source, scheduler& policy, sim_observer* observer);
+
+/**
+ * Counts values in log-linear buckets, 16 per power of two, so any percentile is known to within
+ * about 6% while the histogram stays the same size however many values are recorded.
+ */
+class latency_histogram {
+public:
+    void record(uint64_t value);
+
+    /**
+     * @param p The percentile, 0 < p <= 100.
+     * @return The upper bound of the bucket holding the p-th percentile, or 0 if nothing was recorded.
+     */
+    uint64_t percentile(double p) const;
+
+    uint64_t count() const { return total; }
+
+private:
+    static const int sub_bucket_bits = 4;
+    static const size_t sub_buckets = 1 << sub_bucket_bits;
+    static const size_t num_buckets = sub_buckets + (64 - sub_bucket_bits) * sub_buckets;
+
+    static size_t bucket_of(uint64_t value);
+    static uint64_t bucket_upper_bound(size_t bucket);
+
+    uint64_t counts[num_buckets] = {};
+    uint64_t total = 0;
+    uint64_t max_value = 0;
+};
+
+/**
+ * How a multi-core simulation moves processes between cores.
+ */
+enum class balance_mode {
+    none,   // Per-core run queues; a process stays on the core it arrived on
+    global, // One run queue shared by every core
+    push,   // Per-core run queues; periodically the busiest core pushes work to the idlest
+    steal   // Per-core run queues; a core that runs dry steals from a random other core
+};
+
+/**
+ * Settings for a multi-core simulation.
+ */
+struct smp_options {
+    int cores = 1;
+    balance_mode balancer = balance_mode::steal;
+    sim_time balance_interval = 4; // How often push migration runs
+    uint64_t seed = 10;            // Seeds the choice of steal victims
+};
+
+/**
+ * Results of a multi-core simulation.
+ */
+struct smp_summary {
+    sim_summary totals;                   // Summed over all cores
+    std::vector<sim_time> busy;           // Time each core spent running a process
+    int64_t migrations = 0;               // Times a process moved to a different core
+    latency_histogram turnaround;         // completion - arrival, per process
+    latency_histogram response;           // first_run - arrival, per process
+};
+
+/**
+ * Looks up a load balancer by name: none, global, push or steal.
+ *
+ * @param name The name.
+ * @param mode Receives the balancer.
+ * @return false if the name is unknown.
+ */
+bool parse_balance_mode(const std::string& name, balance_mode& mode);
+
+/**
+ * Runs a workload to completion on several cores. Arrivals are spread over the cores in turn,
+ * and each core's run queue is its own instance of the named policy (or, with the global
+ * balancer, all cores share one). A process that arrives can only preempt the core whose queue
+ * it joined; with a global queue, the first core it would preempt.
+ *
+ * @param source The workload, in arrival order.
+ * @param policy_name The scheduling policy, as accepted by make_scheduler().
+ * @param options Tunables for the policy.
+ * @param smp The number of cores and the load balancer.
+ * @param observer Receives per-process events, or nullptr.
+ * @return Totals, per-core busy time, migration counts and latency distributions.
+ */
+smp_summary simulate_smp(workload_source& source, const std::string& policy_name, const sched_options& options,
+                         const smp_options& smp, sim_observer* observer);
+
+/**
+ * One process in a binary trace file.
+ */
+struct trace_record {
+    int64_t arrival;
+    int64_t burst;
+    int32_t priority;
+    int32_t reserved; // Zero; pads the record to 24 bytes
+};
+
+/**
+ * The first eight bytes of a binary trace file.
+ */
+const char trace_magic[8] = {'S', 'C', 'H', 'E', 'D', 'T', 'R', '1'};
+
+/**
+ * A workload replayed from a trace file of (arrival, burst, priority) records in arrival order.
+ * The file is memory-mapped and parsed as it is consumed, and parsed pages are dropped from the
+ * mapping as it goes, so a trace of any length is replayed in constant memory. Two formats are
+ * read: CSV, one "arrival,burst[,priority]" line per process, where lines that do not start with
+ * a number (headers, '#' comments) are skipped; and binary, trace_magic followed by trace_records.
+ */
+class trace_workload : public workload_source {
+public:
+    trace_workload() {}
+    ~trace_workload();
+    trace_workload(const trace_workload&) = delete;
+    trace_workload& operator=(const trace_workload&) = delete;
+
+    /**
+     * Maps a trace file.
+     *
+     * @param path The file.
+     * @return false (after printing an error) if it cannot be opened or mapped.
+     */
+    bool open(const std::string& path);
+
+    bool next(sim_process& process) override;
+
+    /**
+     * @return The number of CSV lines or binary records skipped so far because they did not
+     *         parse or had a negative time.
+     */
+    int64_t skipped() const { return skipped_lines; }
+
+private:
+    /**
+     * Drops the parsed part of the mapping once enough of it has built up.
+     */
+    void release_consumed();
+
+    char* data = nullptr;
+    size_t size = 0;
+    size_t position = 0;
+    size_t released = 0;
+    bool binary = false;
+    int64_t skipped_lines = 0;
+};
+
+/**
+ * The 'trace' builtin. Usage:
+ * trace capture file   start recording every child process the shell reaps
+ * trace stop           write the recorded processes to the capture file as CSV
+ * trace convert in out convert a CSV trace to the binary format
+ * trace info file      stream through a trace and summarize it
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ */
+void trace_command(const std::vector<std::string>& tokens);
+
+/**
+ * Records a reaped child in the running trace capture, if there is one. Its arrival is when its
+ * job started, relative to the start of the capture, and its burst is its user plus system CPU time.
+ *
+ * @param owner The job the child belonged to.
+ * @param usage The child's resource usage, from wait4().
+ */
+void capture_child(const job& owner, const struct rusage& usage);
+
+/**
+ * A trace capture started with 'trace capture'.
+ */
+struct trace_capture {
+    bool active = false;
+    std::string path;                 // Where 'trace stop' writes the records
+    struct timespec start = {0, 0};   // CLOCK_MONOTONIC when the capture started; arrival 0
+    std::vector<sim_process> records; // One per reaped child, in reaping order
+};
+
+/**
+ * The running trace capture, if any.
+ */
+trace_capture current_capture;
+
+/**
+ * Redirects standard output to the file named by '>' in the tokens, if there is one.
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ * @param saved_stdout Receives a copy of the original standard output, or -1 if nothing was redirected.
+ * @return false (after printing an error) if the file could not be opened, true otherwise.
+ */
+bool redirect_stdout(const std::vector<std::string>& tokens, int& saved_stdout);
+
+/**
+ * Flushes std::cout and puts back the standard output saved by redirect_stdout().
+ *
+ * @param saved_stdout The descriptor from redirect_stdout(), or -1.
+ */
+void restore_stdout(int saved_stdout);
+
+/**
+ * Simulates First-Come-First-Served (FCFS) CPU scheduling for a given number of processes.
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ */
+void fcfs_simulation(const std::vector<std::string>& tokens);
+
+/**
+ * Compares scheduling policies on a random workload with arrival times. Usage:
+ * sched [-p fcfs,sjf,srtf,prio,rr,mlfq|all] [-n processes] [-i mean_interarrival] [-q quantum]
+ *       [-t trace] [-a aging] [-b boost] [-s seed] [-c cores] [-l none|global|push|steal]
+ *       [-m balance_interval] [-v] [> file]
+ * -t replays a trace file (see trace_workload) instead of generating a random workload.
+ * With more than one core, it also reports turnaround percentiles, migrations and per-core utilization.
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ */
+void sched_simulation(const std::vector<std::string>& tokens);
+
+/**
+ * Runs many independent simulations in parallel over a grid of policies, burst distributions
+ * and process counts, and prints each cell's mean results with 95% confidence intervals. Usage:
+ * sweep [-p fcfs,sjf,srtf,prio,rr,mlfq|all] [-d uniform,exp,pareto,trace:file] [-n count,count,...]
+ *       [-r replications] [-j threads] [-i mean_interarrival] [-q quantum] [-c cores]
+ *       [-l none|global|push|steal] [-s seed] [> file]
+ *
+ * @param tokens A vector of strings representing the command tokens.
+ */
+void sweep_simulation(const std::vector<std::string>& tokens);
+
+int main(int argc, char* argv[]) {
+    // Reap children through a signalfd instead of blocking in wait4()
+    init_child_signals();
+
+    // myshell -j N script runs the script's commands in parallel instead of reading commands interactively
+    if (argc > 1) {
+        int workers = 0;
+        if (argc == 4 && std::string(argv[1]) == "-j") {
+            try {
+                workers = std::stoi(argv[2]);
+            } catch (const std::exception& e) {
+                workers = 0;
+            }
+        }
+        if (workers <= 0) {
+            std::cerr << "Usage: " << argv[0] << " [-j N script]" << std::endl;
+            return EXIT_FAILURE;
+        }
+        return run_batch(workers, argv[3]);
+    }
+    bool interactive = isatty(STDIN_FILENO);
+
+    // Start an infinite loop for the shell
+    while (true) {
+        try {
+            // Report background jobs that finished, then print the shell prompt
+            report_finished_jobs();
+            std::cout << "myshell> ";
+            if (interactive) {
+                std::cout.flush();
+                wait_for_input();
+            }
+
+            // Read user input into a string
+            std::string user_input;
+            if (!std::getline(std::cin, user_input)) {
+                // End of input (Ctrl-D or the end of a piped script) ends the shell like 'quit'
+                std::cout << std::endl;
+                break;
+            }
+
+            // Handle empty input by continuing to the next iteration
+            if (user_input.empty()) {
+                continue;
+            }
+
+            // Tokenize the user input
+            std::vector<std::string> tokens = tokenize_line(user_input);
+            if (tokens.empty()) {
+                continue;
+            }
+
+            // Check for special commands
+            if (tokens[0] == "quit" || tokens[0] == "q") {
+                // If the user entered 'quit' or 'q', exit the shell
+                break;
+            } else if (tokens[0] == "fcfs") {
+                // If the user entered 'fcfs', call the fcfs_simulation function
+                fcfs_simulation(tokens);
+            } else if (tokens[0] == "sched") {
+                // If the user entered 'sched', compare scheduling policies
+                sched_simulation(tokens);
+            } else if (tokens[0] == "sweep") {
+                // If the user entered 'sweep', run a Monte Carlo parameter sweep
+                sweep_simulation(tokens);
+            } else if (tokens[0] == "trace") {
+                trace_command(tokens);
+            } else if (tokens[0] == "launch") {
+                // 'launch fork' or 'launch spawn' selects how commands are started
+                if (tokens.size() == 2 && tokens[1] == "fork") {
+                    current_launch_mode = launch_mode::fork_exec;
+                } else if (tokens.size() == 2 && tokens[1] == "spawn") {
+                    current_launch_mode = launch_mode::spawn;
+                } else {
+                    std::cerr << "Usage: launch fork|spawn" << std::endl;
+                }
+            } else if (tokens[0] == "spawnbench") {
+                // If the user entered 'spawnbench', compare the two launch paths
+                spawn_benchmark(tokens);
+            } else if (tokens[0] == "jobs") {
+                jobs_command(tokens);
+            } else if (tokens[0] == "wait" || tokens[0] == "fg") {
+                wait_command(tokens);
+            } else if (tokens[0] == "time") {
+                time_command(tokens);
+            } else if (tokens[0] == "stats") {
+                stats_command(tokens);
+            } else {
+                // If it's not a special command, execute the entered command
+                last_command = command_stats();
+                execute_command(tokens);
+                if (stats_mode && !last_command.command.empty()) {
+                    report_command_stats(last_command);
+                }
+            }
+        } catch (const std::exception& e) {
+            // Handle exceptions and display error messages
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    // The stats mode ends the session with its summary
+    if (stats_mode) {
+        print_session_summary();
+    }
+
+    // Exit the shell
+    return 0;
+}
+
+
+std::vector<std::string> tokenize_line(const std::string& line) {
+    std::istringstream iss(line);
+    std::vector<std::string> tokens;
+    std::string word;
+
+    // Split on whitespace first, then break each word apart at any '|' or '&'
+    while (iss >> word) {
+        std::string token;
+        for (char c : word) {
+            if (c == '|' || c == '&') {
+                if (!token.empty()) {
+                    tokens.push_back(token);
+                    token.clear();
+                }
+                tokens.push_back(std::string(1, c));
+            } else {
+                token += c;
+            }
+        }
+        if (!token.empty()) {
+            tokens.push_back(token);
+        }
+    }
+
+    return tokens;
+}
+
+bool split_pipeline(const std::vector<std::string>& tokens, std::vector<std::vector<std::string>>& stages) {
+    stages.clear();
+    stages.emplace_back();
+
+    for (const std::string& token : tokens) {
+        if (token == "|") {
+            // A '|' must close a non-empty stage
+            if (stages.back().empty()) {
+                return false;
+            }
+            stages.emplace_back();
+        } else {
+            stages.back().push_back(token);
+        }
+    }
+
+    // The last stage must not be empty either
+    return !stages.back().empty();
+}
+
+int execute_command(const std::vector<std::string>& tokens) {
+    // A trailing '&' makes the command a background job; '&' anywhere else is an error
+    std::vector<std::string> command_tokens = tokens;
+    bool background = !command_tokens.empty() && command_tokens.back() == "&";
+    if (background) {
+        command_tokens.pop_back();
+    }
+    if (std::find(command_tokens.begin(), command_tokens.end(), "&") != command_tokens.end()) {
+        std::cerr << "'&' is only allowed at the end of a command." << std::endl;
+        return W_EXITCODE(EXIT_FAILURE, 0);
+    }
+
+    int status;
+    int job_id = start_job(command_tokens, background, status);
+    if (job_id == 0) {
+        return status;
+    }
+
+    if (background) {
+        std::cout << "[" << job_id << "] " << job_table[job_id].pids.back() << std::endl;
+        return 0;
+    }
+
+    // Wait for every stage to complete
+    return wait_for_job(job_id);
+}
+
+int start_job(const std::vector<std::string>& command_tokens, bool background, int& status) {
+    // Break the command into pipeline stages
+    std::vector<std::vector<std::string>> stages;
+    if (!split_pipeline(command_tokens, stages)) {
+        std::cerr << "Invalid null command." << std::endl;
+        status = W_EXITCODE(EXIT_FAILURE, 0);
+        return 0;
+    }
+
+    // Create one pipe between each pair of neighbouring stages. O_CLOEXEC keeps the pipe
+    // ends from leaking into programs that are exec'd, so a reader sees EOF as soon as its
+    // writer exits.
+    size_t num_pipes = stages.size() - 1;
+    std::vector<int> pipe_fds(num_pipes * 2);
+    for (size_t i = 0; i < num_pipes; ++i) {
+        if (pipe2(&pipe_fds[i * 2], O_CLOEXEC) == -1) {
+            std::cerr << "Pipe Error" << std::endl;
+            for (size_t j = 0; j < i * 2; ++j) {
+                close(pipe_fds[j]);
+            }
+            status = W_EXITCODE(EXIT_FAILURE, 0);
+            return 0;
+        }
+    }
+
+    // Like other shells without job control, give a background job /dev/null as its input so it
+    // cannot compete with the shell for the terminal or the rest of a script
+    int null_fd = -1;
+    if (background) {
+        null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    // The job's status stays "command not found" unless its final stage starts
+    job new_job;
+    new_job.background = background;
+    new_job.status = W_EXITCODE(127, 0);
+    for (size_t i = 0; i < command_tokens.size(); ++i) {
+        new_job.command += (i > 0 ? " " : "") + command_tokens[i];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &new_job.start_time);
+
+    // Start every stage before waiting for any, so the stages run concurrently
+    for (size_t i = 0; i < stages.size(); ++i) {
+        // Read from the previous stage's pipe and write to the next stage's pipe
+        int in_fd = i > 0 ? pipe_fds[(i - 1) * 2] : null_fd;
+        int out_fd = i < num_pipes ? pipe_fds[i * 2 + 1] : -1;
+
+        pid_t pid = launch_stage(stages[i], in_fd, out_fd, pipe_fds, current_launch_mode);
+        if (pid != -1) {
+            new_job.pids.push_back(pid);
+            if (i + 1 == stages.size()) {
+                new_job.last_pid = pid;
+            }
+        }
+    }
+    new_job.running = new_job.pids.size();
+
+    // Parent process
+    // Close the parent's copies of the pipe ends so each reader sees EOF
+    for (int fd : pipe_fds) {
+        close(fd);
+    }
+    if (null_fd != -1) {
+        close(null_fd);
+    }
+
+    if (new_job.pids.empty()) {
+        status = new_job.status;
+        return 0;
+    }
+
+    // Number jobs from 1, continuing after the highest number still in the table
+    int job_id = job_table.empty() ? 1 : job_table.rbegin()->first + 1;
+    job_table[job_id] = new_job;
+    return job_id;
+}
+
+/**
+ * Describes a wait status the way the job reports show it.
+ *
+ * @param status A wait status.
+ * @return "Done", "Exit N" or the name of the terminating signal.
+ */
+static std::string describe_status(int status) {
+    if (WIFSIGNALED(status)) {
+        return strsignal(WTERMSIG(status));
+    }
+    if (WEXITSTATUS(status) == 0) {
+        return "Done";
+    }
+    return "Exit " + std::to_string(WEXITSTATUS(status));
+}
+
+void init_child_signals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    // A blocked signal stays pending, and a pending SIGCHLD makes the signalfd readable
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    child_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (child_signal_fd == -1) {
+        std::cerr << "signalfd Error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void reap_children() {
+    // Drain the signalfd; several exits can be folded into one SIGCHLD, so the signal
+    // only says that wait4() has something to return
+    struct signalfd_siginfo info;
+    while (read(child_signal_fd, &info, sizeof(info)) == sizeof(info)) {
+    }
+
+    int status;
+    pid_t pid;
+    struct rusage usage;
+    while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        for (auto& entry : job_table) {
+            job& j = entry.second;
+            if (std::find(j.pids.begin(), j.pids.end(), pid) != j.pids.end()) {
+                capture_child(j, usage);
+                add_rusage(j.usage, usage);
+                j.running--;
+                if (pid == j.last_pid) {
+                    j.status = status;
+                }
+                if (j.running == 0) {
+                    clock_gettime(CLOCK_MONOTONIC, &j.end_time);
+                }
+                break;
+            }
+        }
+    }
+}
+
+void wait_for_child_event() {
+    struct pollfd pfd = {child_signal_fd, POLLIN, 0};
+    if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+        std::cerr << "poll Error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    reap_children();
+}
+
+int wait_for_job(int job_id) {
+    reap_children();
+    while (job_table[job_id].running > 0) {
+        // Sleep until some child exits
+        wait_for_child_event();
+    }
+
+    // Keep what the job used for 'time' and the stats mode
+    const job& finished = job_table[job_id];
+    last_command.command = finished.command;
+    last_command.status = finished.status;
+    last_command.wall_ms = (finished.end_time.tv_sec - finished.start_time.tv_sec) * 1e3 +
+                           (finished.end_time.tv_nsec - finished.start_time.tv_nsec) / 1e6;
+    last_command.usage = finished.usage;
+
+    int status = finished.status;
+    job_table.erase(job_id);
+    return status;
+}
+
+/**
+ * Adds one timeval to another, carrying microseconds into seconds.
+ */
+static void add_timeval(struct timeval& total, const struct timeval& add) {
+    total.tv_sec += add.tv_sec;
+    total.tv_usec += add.tv_usec;
+    if (total.tv_usec >= 1000000) {
+        total.tv_sec++;
+        total.tv_usec -= 1000000;
+    }
+}
+
+void add_rusage(struct rusage& total, const struct rusage& child) {
+    add_timeval(total.ru_utime, child.ru_utime);
+    add_timeval(total.ru_stime, child.ru_stime);
+    total.ru_maxrss = std::max(total.ru_maxrss, child.ru_maxrss);
+    total.ru_minflt += child.ru_minflt;
+    total.ru_majflt += child.ru_majflt;
+    total.ru_inblock += child.ru_inblock;
+    total.ru_oublock += child.ru_oublock;
+    total.ru_nvcsw += child.ru_nvcsw;
+    total.ru_nivcsw += child.ru_nivcsw;
+}
+
+/**
+ * @return A timeval in milliseconds.
+ */
+static double timeval_ms(const struct timeval& tv) {
+    return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+void report_command_stats(const command_stats& stats) {
+    std::cerr << std::fixed << std::setprecision(3) << "real " << stats.wall_ms / 1e3 << "s  user "
+              << timeval_ms(stats.usage.ru_utime) / 1e3 << "s  sys " << timeval_ms(stats.usage.ru_stime) / 1e3
+              << "s  maxrss " << stats.usage.ru_maxrss << " KB  faults " << stats.usage.ru_minflt << " minor "
+              << stats.usage.ru_majflt << " major  switches " << stats.usage.ru_nvcsw << " voluntary "
+              << stats.usage.ru_nivcsw << " involuntary" << std::endl;
+    std::cerr.unsetf(std::ios::floatfield);
+    session_stats.push_back(stats);
+}
+
+void time_command(const std::vector<std::string>& tokens) {
+    std::vector<std::string> command(tokens.begin() + 1, tokens.end());
+    if (command.empty()) {
+        std::cerr << "Usage: time command" << std::endl;
+        return;
+    }
+    if (command.back() == "&") {
+        std::cerr << "time: cannot time a background job." << std::endl;
+        return;
+    }
+
+    last_command = command_stats();
+    execute_command(command);
+    if (!last_command.command.empty()) {
+        report_command_stats(last_command);
+    }
+}
+
+void stats_command(const std::vector<std::string>& tokens) {
+    if (tokens.size() == 2 && tokens[1] == "on") {
+        stats_mode = true;
+    } else if (tokens.size() == 2 && tokens[1] == "off") {
+        stats_mode = false;
+    } else if (tokens.size() == 1) {
+        print_session_summary();
+    } else {
+        std::cerr << "Usage: stats [on|off]" << std::endl;
+    }
+}
+
+void print_session_summary() {
+    double wall_ms = 0.0;
+    double user_ms = 0.0;
+    double sys_ms = 0.0;
+    for (const command_stats& stats : session_stats) {
+        wall_ms += stats.wall_ms;
+        user_ms += timeval_ms(stats.usage.ru_utime);
+        sys_ms += timeval_ms(stats.usage.ru_stime);
+    }
+    std::cerr << std::fixed << std::setprecision(3) << session_stats.size() << " commands timed: " << wall_ms
+              << " ms wall, " << user_ms << " ms user, " << sys_ms << " ms sys" << std::endl;
+    if (session_stats.empty()) {
+        std::cerr.unsetf(std::ios::floatfield);
+        return;
+    }
+
+    // The ten slowest by wall time, slowest first
+    std::vector<const command_stats*> slowest;
+    for (const command_stats& stats : session_stats) {
+        slowest.push_back(&stats);
+    }
+    size_t shown = std::min<size_t>(10, slowest.size());
+    std::partial_sort(slowest.begin(), slowest.begin() + shown, slowest.end(),
+                      [](const command_stats* a, const command_stats* b) { return a->wall_ms > b->wall_ms; });
+
+    std::cerr << std::right << std::setw(12) << "wall_ms" << std::setw(12) << "user_ms" << std::setw(12) << "sys_ms"
+              << std::setw(12) << "maxrss_kb" << std::setw(10) << "majflt" << "  command" << std::endl;
+    for (size_t i = 0; i < shown; ++i) {
+        const command_stats& stats = *slowest[i];
+        std::cerr << std::setw(12) << stats.wall_ms << std::setw(12) << timeval_ms(stats.usage.ru_utime)
+                  << std::setw(12) << timeval_ms(stats.usage.ru_stime) << std::setw(12) << stats.usage.ru_maxrss
+                  << std::setw(10) << stats.usage.ru_majflt << "  " << stats.command << std::endl;
+    }
+    std::cerr.unsetf(std::ios::floatfield);
+}
+
+void report_finished_jobs() {
+    reap_children();
+    for (auto it = job_table.begin(); it != job_table.end();) {
+        if (it->second.background && it->second.running == 0) {
+            std::cout << "[" << it->first << "] " << describe_status(it->second.status) << "  "
+                      << it->second.command << std::endl;
+            it = job_table.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void wait_for_input() {
+    // A terminal in canonical mode returns one line per read(), so nothing is left buffered
+    // in std::cin between prompts and polling the descriptor is safe
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {child_signal_fd, POLLIN, 0}};
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[1].revents & POLLIN) {
+            reap_children();
+        }
+        if (fds[0].revents) {
+            return;
+        }
+    }
+}
+
+void jobs_command(const std::vector<std::string>& tokens) {
+    reap_children();
+    for (auto it = job_table.begin(); it != job_table.end();) {
+        const job& j = it->second;
+        if (!j.background) {
+            ++it;
+            continue;
+        }
+        std::cout << "[" << it->first << "] " << (j.running > 0 ? "Running" : describe_status(j.status)) << "  "
+                  << j.command << std::endl;
+
+        // A finished job is reported once, here instead of at the next prompt
+        if (j.running == 0) {
+            it = job_table.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void wait_command(const std::vector<std::string>& tokens) {
+    bool fg = tokens[0] == "fg";
+
+    // Collect the background jobs to wait for: the one named, or all of them
+    std::vector<int> job_ids;
+    if (tokens.size() > 1) {
+        try {
+            // Accept both "fg 2" and "fg %2"
+            const std::string& spec = tokens[1];
+            job_ids.push_back(std::stoi(spec[0] == '%' ? spec.substr(1) : spec));
+        } catch (const std::exception& e) {
+            std::cerr << "Usage: " << tokens[0] << " [job]" << std::endl;
+            return;
+        }
+        if (job_table.count(job_ids[0]) == 0 || !job_table[job_ids[0]].background) {
+            std::cerr << tokens[0] << ": no such job: " << job_ids[0] << std::endl;
+            return;
+        }
+    } else {
+        for (const auto& entry : job_table) {
+            if (entry.second.background) {
+                job_ids.push_back(entry.first);
+            }
+        }
+        if (fg) {
+            if (job_ids.empty()) {
+                std::cerr << "fg: no current job" << std::endl;
+                return;
+            }
+            job_ids.erase(job_ids.begin(), job_ids.end() - 1);
+        }
+    }
+
+    for (int job_id : job_ids) {
+        std::string command = job_table[job_id].command;
+        if (fg) {
+            // Like a shell bringing a job to the foreground, echo its command and then wait quietly
+            std::cout << command << std::endl;
+            wait_for_job(job_id);
+        } else {
+            int status = wait_for_job(job_id);
+            std::cout << "[" << job_id << "] " << describe_status(status) << "  " << command << std::endl;
+        }
+    }
+}
+
+/**
+ * One command of a batch script and, once it has finished, its result.
+ */
+struct batch_command {
+    size_t line;                      // Line number in the script
+    std::vector<std::string> tokens;  // Tokens, without any trailing '&'
+    int status = 0;                   // Wait status of the final stage
+    double wall_ms = 0.0;             // Time from start to the last process being reaped
+    struct rusage usage = {};         // Summed over the command's processes
+};
+
+int run_batch(int workers, const std::string& script_path) {
+    std::ifstream script(script_path);
+    if (!script.is_open()) {
+        std::cerr << "Couldn't open: " << script_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Parse the whole script up front; each line is an independent command
+    std::vector<batch_command> commands;
+    std::string line;
+    for (size_t line_number = 1; std::getline(script, line); ++line_number) {
+        std::vector<std::string> tokens = tokenize_line(line);
+        if (tokens.empty() || tokens[0][0] == '#') {
+            continue;
+        }
+
+        // Every command already runs alongside the others, so a trailing '&' changes nothing
+        if (tokens.back() == "&") {
+            tokens.pop_back();
+        }
+        batch_command command;
+        command.line = line_number;
+        command.tokens = tokens;
+        commands.push_back(command);
+    }
+
+    struct timespec batch_start;
+    clock_gettime(CLOCK_MONOTONIC, &batch_start);
+
+    // The work queue is the next command to start; in_flight maps running job numbers to commands
+    size_t next = 0;
+    std::map<int, size_t> in_flight;
+    while (next < commands.size() || !in_flight.empty()) {
+        // Fill the free slots. Commands get /dev/null as input, as background jobs do.
+        while (next < commands.size() && in_flight.size() < static_cast<size_t>(workers)) {
+            int status;
+            int job_id = start_job(commands[next].tokens, true, status);
+            if (job_id == 0) {
+                commands[next].status = status;
+            } else {
+                in_flight[job_id] = next;
+            }
+            next++;
+        }
+        if (in_flight.empty()) {
+            continue;
+        }
+
+        // Sleep until a child exits, then collect every job that has completely finished
+        wait_for_child_event();
+        for (auto it = in_flight.begin(); it != in_flight.end();) {
+            const job& j = job_table[it->first];
+            if (j.running > 0) {
+                ++it;
+                continue;
+            }
+            batch_command& command = commands[it->second];
+            command.status = wait_for_job(it->first);
+            command.wall_ms = last_command.wall_ms;
+            command.usage = last_command.usage;
+            it = in_flight.erase(it);
+        }
+    }
+
+    struct timespec batch_end;
+    clock_gettime(CLOCK_MONOTONIC, &batch_end);
+    double batch_ms = (batch_end.tv_sec - batch_start.tv_sec) * 1e3 + (batch_end.tv_nsec - batch_start.tv_nsec) / 1e6;
+
+    // Summarize on stderr so standard output holds only the commands' own output
+    size_t failed = 0;
+    double total_ms = 0.0;
+    std::cerr << std::left << std::setw(6) << "line" << std::setw(8) << "exit" << std::right << std::setw(12)
+              << "wall_ms" << std::setw(12) << "user_ms" << std::setw(12) << "sys_ms" << std::setw(12) << "maxrss_kb"
+              << "  command" << std::endl;
+    for (const batch_command& command : commands) {
+        std::string exit_code = WIFSIGNALED(command.status) ? "SIG" + std::to_string(WTERMSIG(command.status))
+                                                            : std::to_string(WEXITSTATUS(command.status));
+        if (WIFSIGNALED(command.status) || WEXITSTATUS(command.status) != 0) {
+            failed++;
+        }
+        total_ms += command.wall_ms;
+
+        std::string text;
+        for (size_t i = 0; i < command.tokens.size(); ++i) {
+            text += (i > 0 ? " " : "") + command.tokens[i];
+        }
+        std::cerr << std::left << std::setw(6) << command.line << std::setw(8) << exit_code << std::right
+                  << std::setw(12) << std::fixed << std::setprecision(3) << command.wall_ms << std::setw(12)
+                  << timeval_ms(command.usage.ru_utime) << std::setw(12) << timeval_ms(command.usage.ru_stime)
+                  << std::setw(12) << command.usage.ru_maxrss << "  " << text << std::endl;
+    }
+    std::cerr << commands.size() << " commands, " << failed << " failed, " << workers << " workers: " << batch_ms
+              << " ms elapsed, " << total_ms << " ms of command time (" << std::setprecision(2)
+              << (batch_ms > 0.0 ? total_ms / batch_ms : 0.0) << "x parallelism)" << std::endl;
+    std::cerr.unsetf(std::ios::floatfield);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Starts a stage with posix_spawnp(), expressing the pipe and '>' redirections as file actions.
+ *
+ * @param stage The tokens of the stage, including any '>' redirection.
+ * @param in_fd The descriptor to use as standard input, or -1 to inherit the shell's.
+ * @param out_fd The descriptor to use as standard output, or -1 to inherit the shell's.
+ * @return The child's pid, or -1 if it could not be started.
+ */
+static pid_t spawn_stage(const std::vector<std::string>& stage, int in_fd, int out_fd) {
+    std::string output_file;
+    if (!find_output_file(stage, output_file)) {
+        return -1;
+    }
+
+    // The actions run in the child in order, so '>' overrides a pipe on standard output.
+    // dup2 clears O_CLOEXEC on the target; the pipe ends themselves close at exec.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (out_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    if (!output_file.empty()) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, output_file.c_str(),
+                                         O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+
+    // The shell blocks SIGCHLD for its signalfd; programs start with an empty mask
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t empty_mask;
+    sigemptyset(&empty_mask);
+    posix_spawnattr_setsigmask(&attributes, &empty_mask);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+    std::vector<char*> args = build_args(stage);
+    pid_t pid;
+    int error = posix_spawnp(&pid, args[0], &actions, &attributes, args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+
+    if (error != 0) {
+        std::cerr << "Couldn't execute: " << args[0] << " (" << strerror(error) << ")" << std::endl;
+        return -1;
+    }
+    return pid;
+}
+
+pid_t launch_stage(const std::vector<std::string>& stage, int in_fd, int out_fd, const std::vector<int>& pipe_fds,
+                   launch_mode mode) {
+    if (mode == launch_mode::spawn && !is_splice_builtin(stage)) {
+        return spawn_stage(stage, in_fd, out_fd);
+    }
+
+    // Create a child process
+    pid_t pid = fork();
+
+    // Check for errors in fork()
+    if (pid == -1) {
+        std::cerr << "Fork Error" << std::endl;
+    } else if (pid == 0) {
+        // Child process
+        // Undo the shell's SIGCHLD block so the program starts with an empty signal mask
+        sigset_t empty_mask;
+        sigemptyset(&empty_mask);
+        sigprocmask(SIG_SETMASK, &empty_mask, nullptr);
+
+        // Connect the pipes to standard input and output
+        if (in_fd != -1) {
+            dup2(in_fd, STDIN_FILENO);
+        }
+        if (out_fd != -1) {
+            dup2(out_fd, STDOUT_FILENO);
+        }
+
+        // Builtins are not exec'd, so close every pipe end explicitly
+        for (int fd : pipe_fds) {
+            close(fd);
+        }
+
+        // Handle output redirection if the '>' operator is present in this stage
+        redirect_output(stage);
+
+        if (is_splice_builtin(stage)) {
+            _exit(run_splice_builtin(stage));
+        }
+
+        // Execute the command specified by the argument list
+        std::vector<char*> args = build_args(stage);
+        execvp(args[0], args.data());
+
+        // If execvp() fails, print an error message and exit the child process
+        std::cerr << "Couldn't execute: " << args[0] << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    return pid;
+}
+
+std::vector<char*> build_args(const std::vector<std::string>& stage) {
+    // Create a vector to store the command arguments
+    std::vector<char*> args;
+
+    // Iterate through tokens and construct the argument list, excluding redirection
+    for (const std::string& token : stage) {
+        // If the token starts with '>', stop processing (redirection is handled separately)
+        if (token.find(">") == 0) {
+            break;
+        }
+
+        // Add the token as a C-style string to the argument list
+        args.push_back(const_cast<char*>(token.c_str()));
+    }
+
+    // Add a nullptr at the end of the argument list to mark the end
+    args.push_back(nullptr);
+    return args;
+}
+
+bool is_splice_builtin(const std::vector<std::string>& stage) {
+    // Count the operands before any output redirection
+    size_t operands = 0;
+    while (operands + 1 < stage.size() && stage[operands + 1].find(">") != 0) {
+        ++operands;
+    }
+
+    return (stage[0] == "cat" && operands == 0) || (stage[0] == "tee" && operands == 1);
+}
+
+/**
+ * Copies everything from in_fd to each of out_fds through a user-space buffer.
+ *
+ * @param in_fd The descriptor to read until end of file.
+ * @param out_fds The descriptors that receive every byte read.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE on a read or write error.
+ */
+static int copy_with_read_write(int in_fd, const std::vector<int>& out_fds) {
+    std::vector<char> buffer(1 << 16);
+
+    while (true) {
+        ssize_t bytes_read = read(in_fd, buffer.data(), buffer.size());
+        if (bytes_read == 0) {
+            return EXIT_SUCCESS;
+        }
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return EXIT_FAILURE;
+        }
+
+        for (int out_fd : out_fds) {
+            ssize_t written = 0;
+            while (written < bytes_read) {
+                ssize_t n = write(out_fd, buffer.data() + written, bytes_read - written);
+                if (n == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return EXIT_FAILURE;
+                }
+                written += n;
+            }
+        }
+    }
+}
+
+/**
+ * Moves exactly count bytes from the pipe in_fd to out_fd with splice(2).
+ *
+ * @param in_fd A pipe holding at least count bytes.
+ * @param out_fd The destination descriptor.
+ * @param count The number of bytes to move.
+ * @return true on success, false on a splice error.
+ */
+static bool splice_exactly(int in_fd, int out_fd, size_t count) {
+    while (count > 0) {
+        ssize_t n = splice(in_fd, nullptr, out_fd, nullptr, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        count -= n;
+    }
+    return true;
+}
+
+int run_splice_builtin(const std::vector<std::string>& stage) {
+    // Move up to 64 KiB, the default pipe capacity, per call
+    const size_t chunk = 1 << 16;
+
+    if (stage[0] == "cat") {
+        // splice() needs a pipe on at least one side; EINVAL on the first call means
+        // neither end is one (e.g. a lone "cat" between two terminals)
+        bool first = true;
+        while (true) {
+            ssize_t n = splice(STDIN_FILENO, nullptr, STDOUT_FILENO, nullptr, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n == 0) {
+                return EXIT_SUCCESS;
+            }
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (first && errno == EINVAL) {
+                    return copy_with_read_write(STDIN_FILENO, {STDOUT_FILENO});
+                }
+                std::cerr << "cat: " << strerror(errno) << std::endl;
+                return EXIT_FAILURE;
+            }
+            first = false;
+        }
+    }
+
+    // tee FILE: duplicate the input pipe's pages into the output pipe with tee(2), then
+    // splice the same pages from the input pipe into the file
+    const std::string& file_name = stage[1];
+    int file_fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (file_fd == -1) {
+        std::cerr << "Couldn't open: " << file_name << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int result = EXIT_SUCCESS;
+    bool first = true;
+    while (true) {
+        ssize_t n = tee(STDIN_FILENO, STDOUT_FILENO, chunk, 0);
+        if (n == 0) {
+            break;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // tee() needs pipes on both sides
+            if (first && errno == EINVAL) {
+                result = copy_with_read_write(STDIN_FILENO, {STDOUT_FILENO, file_fd});
+            } else {
+                std::cerr << "tee: " << strerror(errno) << std::endl;
+                result = EXIT_FAILURE;
+            }
+            break;
+        }
+        first = false;
+
+        if (!splice_exactly(STDIN_FILENO, file_fd, n)) {
+            std::cerr << "tee: " << strerror(errno) << std::endl;
+            result = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    close(file_fd);
+    return result;
+}
+
+bool find_output_file(const std::vector<std::string>& tokens, std::string& output_file) {
+    output_file.clear();
+
+    // Iterate through the 'tokens' vector using an index 'i'
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        // Check if the current token starts with '>'
+        if (tokens[i].find(">") == 0) {
+            // If there are more tokens after the current one, the next token is the file
+            if (i + 1 < tokens.size()) {
+                output_file = tokens[i + 1];
+                return true;
+            }
+
+            // Get the part of the token that follows '>'
+            output_file = tokens[i].substr(1);
+
+            // Check if the extracted filename is empty
+            if (output_file.empty()) {
+                // Error message for a missing output file name
+                std::cerr << "Missing output file name after '>'." << std::endl;
+                return false;
+            }
+            return true;
+        }
+    }
+
+    return true;
+}
+
+void redirect_output(const std::vector<std::string>& tokens) {
+    std::string output_file;
+    if (!find_output_file(tokens, output_file)) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Nothing to do without a redirection operator
+    if (output_file.empty()) {
+        return;
+    }
+
+    // Open the specified file for writing
+    int output_fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (output_fd == -1) {
+        std::cerr << "Couldn't open: " << output_file.c_str() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Duplicate the output file descriptor to standard output (STDOUT_FILENO)
+    // This redirects program output to the specified file
+    dup2(output_fd, STDOUT_FILENO);
+
+    // Close the original output file descriptor since it's no longer needed
+    close(output_fd);
+}
+
+/**
+ * Returns the time elapsed since start in microseconds.
+ *
+ * @param start A CLOCK_MONOTONIC time.
+ * @return The elapsed time in microseconds.
+ */
+static double elapsed_us(const struct timespec& start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1e6 + (now.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+void spawn_benchmark(const std::vector<std::string>& tokens) {
+    int launches = 1000;
+    int ballast_mb = 0;
+
+    try {
+        if (tokens.size() > 1) {
+            launches = std::stoi(tokens[1]);
+        }
+        if (tokens.size() > 2) {
+            ballast_mb = std::stoi(tokens[2]);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Usage: spawnbench [launches] [ballast_mb]" << std::endl;
+        return;
+    }
+    if (launches <= 0 || ballast_mb < 0) {
+        std::cerr << "Usage: spawnbench [launches] [ballast_mb]" << std::endl;
+        return;
+    }
+
+    // Touch every page of the ballast so it is really resident and fork() has to copy its page tables
+    std::vector<char> ballast(static_cast<size_t>(ballast_mb) << 20, 1);
+
+    // At most this many children are in flight during the throughput run
+    const size_t max_in_flight = 64;
+    const std::vector<std::string> command = {"true"};
+    const std::vector<int> no_pipes;
+
+    std::cout << "Launching '" << command[0] << "' " << launches << " times with " << ballast_mb
+              << " MB of ballast" << std::endl;
+
+    for (launch_mode mode : {launch_mode::fork_exec, launch_mode::spawn}) {
+        // Latency: start one child and wait for it before starting the next
+        std::vector<double> latencies;
+        latencies.reserve(launches);
+        for (int i = 0; i < launches; ++i) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            pid_t pid = launch_stage(command, -1, -1, no_pipes, mode);
+            if (pid == -1) {
+                return;
+            }
+            int status;
+            waitpid(pid, &status, 0);
+            latencies.push_back(elapsed_us(start));
+        }
+        std::sort(latencies.begin(), latencies.end());
+        double total_us = 0.0;
+        for (double latency : latencies) {
+            total_us += latency;
+        }
+
+        // Throughput: keep up to max_in_flight children running, reaping the oldest first
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        std::deque<pid_t> in_flight;
+        for (int i = 0; i < launches; ++i) {
+            if (in_flight.size() == max_in_flight) {
+                int status;
+                waitpid(in_flight.front(), &status, 0);
+                in_flight.pop_front();
+            }
+            pid_t pid = launch_stage(command, -1, -1, no_pipes, mode);
+            if (pid != -1) {
+                in_flight.push_back(pid);
+            }
+        }
+        while (!in_flight.empty()) {
+            int status;
+            waitpid(in_flight.front(), &status, 0);
+            in_flight.pop_front();
+        }
+        double throughput_s = elapsed_us(start) / 1e6;
+
+        std::cout << (mode == launch_mode::fork_exec ? "fork+exec:   " : "posix_spawn: ")
+                  << "mean " << total_us / launches << " us, p50 " << latencies[latencies.size() / 2]
+                  << " us, p99 " << latencies[latencies.size() * 99 / 100] << " us, "
+                  << launches / throughput_s << " launches/s" << std::endl;
+    }
+}
+
+int process_table::allocate(const sim_process& process, int64_t process_id) {
+    int slot;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        slot = static_cast<int>(id.size());
+        id.push_back(0);
+        arrival.push_back(0);
+        burst.push_back(0);
+        remaining.push_back(0);
+        first_run.push_back(0);
+        dispatched.push_back(0);
+        priority.push_back(0);
+    }
+
+    id[slot] = process_id;
+    arrival[slot] = process.arrival;
+    burst[slot] = process.burst;
+    remaining[slot] = process.burst;
+    first_run[slot] = -1;
+    dispatched[slot] = -1;
+    priority[slot] = process.priority;
+    return slot;
+}
+
+template <typename T, int D>
+void d_ary_heap<T, D>::push(const T& item) {
+    // Move the hole up from the new leaf until the parent is not larger
+    size_t hole = items.size();
+    items.push_back(item);
+    while (hole > 0) {
+        size_t parent = (hole - 1) / D;
+        if (!(item < items[parent])) {
+            break;
+        }
+        items[hole] = items[parent];
+        hole = parent;
+    }
+    items[hole] = item;
+}
+
+template <typename T, int D>
+void d_ary_heap<T, D>::pop() {
+    // Move the last item into the root's hole and sift it down past smaller children
+    T item = items.back();
+    items.pop_back();
+    size_t size = items.size();
+    if (size == 0) {
+        return;
+    }
+
+    size_t hole = 0;
+    while (true) {
+        size_t first_child = hole * D + 1;
+        if (first_child >= size) {
+            break;
+        }
+        size_t last_child = std::min(first_child + D, size);
+        size_t smallest = first_child;
+        for (size_t child = first_child + 1; child < last_child; ++child) {
+            if (items[child] < items[smallest]) {
+                smallest = child;
+            }
+        }
+        if (!(items[smallest] < item)) {
+            break;
+        }
+        items[hole] = items[smallest];
+        hole = smallest;
+    }
+    items[hole] = item;
+}
+
+void trace_buffer::printf(const char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+
+    if (data.size() + sizeof(line) > (1 << 16)) {
+        flush();
+    }
+    data.append(line, std::min(static_cast<size_t>(length), sizeof(line) - 1));
+}
+
+void trace_buffer::flush() {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += n;
+    }
+    data.clear();
+}
+
+/**
+ * First-come, first-served: run processes in the order they became ready.
+ */
+class fcfs_scheduler : public scheduler {
+public:
+    const char* name() const override { return "fcfs"; }
+    void ready(int slot, sim_time now) override { queue.push_back(slot); }
+    int next(sim_time now) override {
+        if (queue.empty()) {
+            return -1;
+        }
+        int slot = queue.front();
+        queue.pop_front();
+        return slot;
+    }
+    int steal(sim_time now) override {
+        if (queue.empty()) {
+            return -1;
+        }
+        int slot = queue.back();
+        queue.pop_back();
+        return slot;
+    }
+    size_t queued() const override { return queue.size(); }
+
+protected:
+    std::deque<int> queue;
+};
+
+/**
+ * Round robin: FCFS order, but a process goes to the back of the queue after each quantum.
+ */
+class rr_scheduler : public fcfs_scheduler {
+public:
+    explicit rr_scheduler(sim_time quantum) : quantum(quantum) {}
+    const char* name() const override { return "rr"; }
+    sim_time slice(int slot) const override { return quantum; }
+
+private:
+    sim_time quantum;
+};
+
+/**
+ * An entry of a keyed ready queue. Ties on the key go to the earlier arrival.
+ */
+struct ready_entry {
+    sim_time key;
+    int64_t id;
+    int slot;
+
+    bool operator<(const ready_entry& other) const {
+        return key < other.key || (key == other.key && id < other.id);
+    }
+};
+
+/**
+ * Orders ready processes by a key computed when they become ready, smallest first.
+ */
+class keyed_scheduler : public scheduler {
+public:
+    void ready(int slot, sim_time now) override { enqueue(slot, now); }
+    void migrate(int slot, const scheduler& from, sim_time now) override {
+        // Keys that depend on the time (prio's aging) count from when it became ready over there
+        const keyed_scheduler* source = dynamic_cast<const keyed_scheduler*>(&from);
+        enqueue(slot, source != nullptr ? source->ready_since[slot] : now);
+    }
+    int next(sim_time now) override {
+        if (queue.empty()) {
+            return -1;
+        }
+        int slot = queue.top().slot;
+        queue.pop();
+        return slot;
+    }
+    size_t queued() const override { return queue.size(); }
+
+protected:
+    virtual sim_time key(int slot, sim_time now) const = 0;
+
+    d_ary_heap<ready_entry> queue;
+
+private:
+    void enqueue(int slot, sim_time since) {
+        if (ready_since.size() < table->capacity()) {
+            ready_since.resize(table->capacity(), 0);
+        }
+        ready_since[slot] = since;
+        queue.push(ready_entry{key(slot, since), table->id[slot], slot});
+    }
+
+    std::vector<sim_time> ready_since; // When each queued process became ready
+};
+
+/**
+ * Shortest job first (non-preemptive): run the ready process with the smallest burst.
+ */
+class sjf_scheduler : public keyed_scheduler {
+public:
+    const char* name() const override { return "sjf"; }
+
+protected:
+    sim_time key(int slot, sim_time now) const override { return table->burst[slot]; }
+};
+
+/**
+ * Shortest remaining time first: SJF that preempts when a shorter process arrives.
+ */
+class srtf_scheduler : public keyed_scheduler {
+public:
+    const char* name() const override { return "srtf"; }
+    bool preempts(int arriving, int running, sim_time now) const override {
+        return table->remaining[arriving] < table->remaining[running];
+    }
+
+protected:
+    sim_time key(int slot, sim_time now) const override { return table->remaining[slot]; }
+};
+
+/**
+ * Preemptive priority with aging. A process that has waited w ms has an effective priority of
+ * priority - w / aging, so comparing two ready processes at any time t compares
+ * priority * aging + ready_time, a key that does not change while they wait. A process's
+ * age starts over each time it is dispatched.
+ */
+class priority_scheduler : public keyed_scheduler {
+public:
+    explicit priority_scheduler(sim_time aging) : aging(aging) {}
+    const char* name() const override { return "prio"; }
+    bool preempts(int arriving, int running, sim_time now) const override {
+        return key(arriving, now) < key(running, table->dispatched[running]);
+    }
+
+protected:
+    sim_time key(int slot, sim_time now) const override { return table->priority[slot] * aging + now; }
+
+private:
+    sim_time aging;
+};
+
+/**
+ * Multi-level feedback queue. New processes enter the top level; a process that uses its whole
+ * slice drops one level, and level k's slice is quantum << k. Higher levels always run first
+ * and preempt lower ones. Every 'boost' ms all processes move back to the top level: queued
+ * ones are moved, and running ones are caught by the boost epoch when they come back.
+ */
+class mlfq_scheduler : public scheduler {
+public:
+    mlfq_scheduler(sim_time quantum, sim_time boost, int levels)
+        : quantum(quantum), boost(boost), queues(levels), next_boost(boost) {}
+    const char* name() const override { return "mlfq"; }
+    void arrive(int slot, sim_time now) override {
+        reserve_slots();
+        level[slot] = 0;
+        epoch[slot] = current_epoch;
+        ready(slot, now);
+    }
+    void migrate(int slot, const scheduler& from, sim_time now) override {
+        // Bring the level along; this core's boosts keep the same schedule as the other's
+        const mlfq_scheduler* source = dynamic_cast<const mlfq_scheduler*>(&from);
+        reserve_slots();
+        boost_if_due(now);
+        level[slot] = source != nullptr ? std::min(source->level_of(slot), static_cast<int>(queues.size()) - 1) : 0;
+        epoch[slot] = current_epoch;
+        queues[level[slot]].push_back(slot);
+        count++;
+    }
+    void ready(int slot, sim_time now) override {
+        boost_if_due(now);
+        level[slot] = level_of(slot);
+        epoch[slot] = current_epoch;
+        queues[level[slot]].push_back(slot);
+        count++;
+    }
+    int next(sim_time now) override {
+        boost_if_due(now);
+        for (std::deque<int>& queue : queues) {
+            if (!queue.empty()) {
+                int slot = queue.front();
+                queue.pop_front();
+                count--;
+                return slot;
+            }
+        }
+        return -1;
+    }
+    int steal(sim_time now) override {
+        // The thief takes the newest process of the lowest non-empty level
+        boost_if_due(now);
+        for (auto queue = queues.rbegin(); queue != queues.rend(); ++queue) {
+            if (!queue->empty()) {
+                int slot = queue->back();
+                queue->pop_back();
+                count--;
+                return slot;
+            }
+        }
+        return -1;
+    }
+    size_t queued() const override { return count; }
+    sim_time slice(int slot) const override { return quantum << level_of(slot); }
+    bool preempts(int arriving, int running, sim_time now) const override {
+        return level_of(arriving) < level_of(running);
+    }
+    void preempted(int slot, bool slice_expired) override {
+        int current = level_of(slot);
+        if (slice_expired && current + 1 < static_cast<int>(queues.size())) {
+            current++;
+        }
+        level[slot] = current;
+        epoch[slot] = current_epoch;
+    }
+
+private:
+    // A level set before the last boost no longer counts
+    int level_of(int slot) const { return epoch[slot] == current_epoch ? level[slot] : 0; }
+
+    void reserve_slots() {
+        if (level.size() < table->capacity()) {
+            level.resize(table->capacity(), 0);
+            epoch.resize(table->capacity(), 0);
+        }
+    }
+
+    void boost_if_due(sim_time now) {
+        if (now < next_boost) {
+            return;
+        }
+        current_epoch++;
+        for (size_t k = 0; k < queues.size(); ++k) {
+            for (int slot : queues[k]) {
+                level[slot] = 0;
+                epoch[slot] = current_epoch;
+                if (k > 0) {
+                    queues[0].push_back(slot);
+                }
+            }
+            if (k > 0) {
+                queues[k].clear();
+            }
+        }
+        next_boost = (now / boost + 1) * boost;
+    }
+
+    sim_time quantum;
+    sim_time boost;
+    std::vector<std::deque<int>> queues;
+    size_t count = 0;
+    std::vector<int> level;
+    std::vector<uint32_t> epoch;
+    uint32_t current_epoch = 0;
+    sim_time next_boost;
+};
+
+std::unique_ptr<scheduler> make_scheduler(const std::string& name, const sched_options& options) {
+    if (name == "fcfs") {
+        return std::unique_ptr<scheduler>(new fcfs_scheduler());
+    } else if (name == "sjf") {
+        return std::unique_ptr<scheduler>(new sjf_scheduler());
+    } else if (name == "srtf") {
+        return std::unique_ptr<scheduler>(new srtf_scheduler());
+    } else if (name == "prio") {
+        return std::unique_ptr<scheduler>(new priority_scheduler(options.aging));
+    } else if (name == "rr") {
+        return std::unique_ptr<scheduler>(new rr_scheduler(options.quantum));
+    } else if (name == "mlfq") {
+        return std::unique_ptr<scheduler>(new mlfq_scheduler(options.quantum, options.boost, options.mlfq_levels));
+    }
+    return nullptr;
+}
+
+/**
+ * An entry of the engine's event list. At the same instant CPU events come first, so a
+ * process whose slice ends as another arrives is queued behind the new arrival, and load
+ * balancing comes last.
+ */
+struct sim_event {
+    enum type_t { cpu = 0, arrival = 1, balance = 2 };
+
+    sim_time time;
+    int type;
+    uint32_t generation; // For cpu events: stale unless it matches the core's generation
+    int core = 0;        // For cpu events: the core that stops
+
+    bool operator<(const sim_event& other) const {
+        return time < other.time || (time == other.time && (type < other.type ||
+                                                              (type == other.type && core < other.core)));
+    }
+};
+
+sim_summary simulate(workload_source& source, scheduler& policy, sim_observer* observer) {
+    process_table table;
+    policy.attach(table);
+    sim_summary summary;
+
+    // The event list holds at most the next arrival and the running process's stop event;
+    // the rest of the workload stays in the source until it is needed
+    d_ary_heap<sim_event> events;
+    sim_process pending;
+    int64_t next_id = 0;
+    if (source.next(pending)) {
+        events.push(sim_event{pending.arrival, sim_event::arrival, 0});
+    }
+
+    int running = -1;
+    sim_time run_start = 0;
+    uint32_t generation = 0;
+    int64_t last_id = -1;
+    std::vector<int> expired;
+
+    while (!events.empty()) {
+        sim_time now = events.top().time;
+
+        // Handle every event at this instant before choosing what runs next
+        while (!events.empty() && events.top().time == now) {
+            sim_event event = events.top();
+            events.pop();
+            summary.events++;
+
+            if (event.type == sim_event::cpu) {
+                // A stop event left behind by a preempted process
+                if (event.generation != generation) {
+                    continue;
+                }
+
+                table.remaining[running] -= now - run_start;
+                if (table.remaining[running] == 0) {
+                    summary.processes++;
+                    summary.total_turnaround += now - table.arrival[running];
+                    summary.total_waiting += now - table.arrival[running] - table.burst[running];
+                    summary.total_response += table.first_run[running] - table.arrival[running];
+                    summary.makespan = now;
+                    if (observer) {
+                        observer->completed(table, running, now);
+                    }
+                    table.release(running);
+                } else {
+                    // Queued after this instant's arrivals
+                    expired.push_back(running);
+                }
+                running = -1;
+                continue;
+            }
+
+            // An arrival: admit it, then let it preempt the running process if the policy says so
+            int slot = table.allocate(pending, next_id++);
+            policy.arrive(slot, now);
+            if (running != -1) {
+                table.remaining[running] -= now - run_start;
+                run_start = now;
+                if (policy.preempts(slot, running, now)) {
+                    policy.preempted(running, false);
+                    policy.ready(running, now);
+                    running = -1;
+                    generation++;
+                }
+            }
+
+            // Schedule the next arrival; one that claims to arrive in the past arrives now
+            if (source.next(pending)) {
+                events.push(sim_event{std::max(pending.arrival, now), sim_event::arrival, 0});
+            }
+        }
+
+        for (int slot : expired) {
+            policy.preempted(slot, true);
+            policy.ready(slot, now);
+        }
+        expired.clear();
+
+        if (running != -1) {
+            continue;
+        }
+
+        // Dispatch the next ready process and schedule its completion or slice expiry
+        running = policy.next(now);
+        if (running == -1) {
+            continue;
+        }
+        if (table.first_run[running] == -1) {
+            table.first_run[running] = now;
+        }
+        table.dispatched[running] = now;
+        run_start = now;
+        if (table.id[running] != last_id) {
+            summary.context_switches++;
+            last_id = table.id[running];
+        }
+        if (observer) {
+            observer->dispatched(table, running, now);
+        }
+        sim_time run = std::min(table.remaining[running], policy.slice(running));
+        events.push(sim_event{now + run, sim_event::cpu, ++generation});
+    }
+
+    return summary;
+}
+
+size_t latency_histogram::bucket_of(uint64_t value) {
+    if (value < sub_buckets) {
+        return static_cast<size_t>(value);
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - sub_bucket_bits;
+    size_t sub_bucket = static_cast<size_t>(value >> shift) - sub_buckets;
+    return sub_buckets + static_cast<size_t>(shift) * sub_buckets + sub_bucket;
+}
+
+uint64_t latency_histogram::bucket_upper_bound(size_t bucket) {
+    if (bucket < sub_buckets) {
+        return bucket;
+    }
+    size_t shift = (bucket - sub_buckets) / sub_buckets;
+    uint64_t sub_bucket = (bucket - sub_buckets) % sub_buckets;
+    uint64_t lower = (sub_buckets + sub_bucket) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void latency_histogram::record(uint64_t value) {
+    counts[bucket_of(value)]++;
+    total++;
+    max_value = std::max(max_value, value);
+}
+
+uint64_t latency_histogram::percentile(double p) const {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * total));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < num_buckets; ++bucket) {
+        seen += counts[bucket];
+        if (seen >= rank && counts[bucket] > 0) {
+            return std::min(bucket_upper_bound(bucket), max_value);
+        }
+    }
+    return max_value;
+}
+
+bool parse_balance_mode(const std::string& name, balance_mode& mode) {
+    if (name == "none") {
+        mode = balance_mode::none;
+    } else if (name == "global") {
+        mode = balance_mode::global;
+    } else if (name == "push") {
+        mode = balance_mode::push;
+    } else if (name == "steal") {
+        mode = balance_mode::steal;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * What one simulated core is doing.
+ */
+struct sim_core {
+    int running = -1;        // Slot of the running process, or -1 if idle
+    sim_time run_start = 0;  // When 'running' last had its remaining time brought up to date
+    uint32_t generation = 0; // Bumped on every dispatch and preemption, to invalidate stop events
+    int64_t last_id = -1;    // The process that ran last, for counting context switches
+};
+
+smp_summary simulate_smp(workload_source& source, const std::string& policy_name, const sched_options& options,
+                         const smp_options& smp, sim_observer* observer) {
+    int num_cores = smp.cores;
+    process_table table;
+    smp_summary summary;
+    summary.busy.assign(num_cores, 0);
+
+    // One run queue per core, or one for all of them
+    std::vector<std::unique_ptr<scheduler>> queues(smp.balancer == balance_mode::global ? 1 : num_cores);
+    for (std::unique_ptr<scheduler>& queue : queues) {
+        queue = make_scheduler(policy_name, options);
+        queue->attach(table);
+    }
+    auto queue_of = [&](int core) -> scheduler& { return *queues[queues.size() == 1 ? 0 : core]; };
+
+    std::vector<sim_core> cores(num_cores);
+    std::vector<int> home; // Per slot: the core the process last ran or was queued on, or -1
+    int64_t live = 0;      // Processes that arrived and have not completed
+
+    // Brings the running process's remaining time and the core's busy time up to 'now'
+    auto settle = [&](int core, sim_time now) {
+        sim_core& c = cores[core];
+        table.remaining[c.running] -= now - c.run_start;
+        summary.busy[core] += now - c.run_start;
+        c.run_start = now;
+    };
+
+    d_ary_heap<sim_event> events;
+    sim_process pending;
+    int64_t next_id = 0;
+    bool more_arrivals = source.next(pending);
+    if (more_arrivals) {
+        events.push(sim_event{pending.arrival, sim_event::arrival, 0});
+    }
+    if (smp.balancer == balance_mode::push && more_arrivals) {
+        events.push(sim_event{pending.arrival + smp.balance_interval, sim_event::balance, 0});
+    }
+
+    std::mt19937_64 victim_rng(smp.seed);
+    std::vector<std::pair<int, int>> expired; // (core, slot) of processes whose slice ended
+
+    while (!events.empty()) {
+        sim_time now = events.top().time;
+
+        // Handle every event at this instant before choosing what runs next
+        while (!events.empty() && events.top().time == now) {
+            sim_event event = events.top();
+            events.pop();
+            summary.totals.events++;
+
+            if (event.type == sim_event::cpu) {
+                sim_core& c = cores[event.core];
+                if (event.generation != c.generation) {
+                    continue;
+                }
+
+                int slot = c.running;
+                settle(event.core, now);
+                c.running = -1;
+                if (table.remaining[slot] == 0) {
+                    sim_time turnaround = now - table.arrival[slot];
+                    sim_time response = table.first_run[slot] - table.arrival[slot];
+                    summary.totals.processes++;
+                    summary.totals.total_turnaround += turnaround;
+                    summary.totals.total_waiting += turnaround - table.burst[slot];
+                    summary.totals.total_response += response;
+                    summary.totals.makespan = now;
+                    summary.turnaround.record(turnaround);
+                    summary.response.record(response);
+                    if (observer) {
+                        observer->completed(table, slot, now);
+                    }
+                    table.release(slot);
+                    live--;
+                } else {
+                    expired.push_back(std::make_pair(event.core, slot));
+                }
+            } else if (event.type == sim_event::arrival) {
+                // Place the arrival on the next core in turn
+                int slot = table.allocate(pending, next_id);
+                int core = static_cast<int>(next_id % num_cores);
+                next_id++;
+                live++;
+                if (home.size() < table.capacity()) {
+                    home.resize(table.capacity());
+                }
+                home[slot] = queues.size() == 1 ? -1 : core;
+                scheduler& queue = queue_of(core);
+                queue.arrive(slot, now);
+
+                // It may preempt its own core, or with a global queue any core. An idle core that
+                // can take it makes preemption unnecessary; otherwise it takes the core whose
+                // process loses to it by the most
+                int first = queues.size() == 1 ? 0 : core;
+                int last = queues.size() == 1 ? num_cores : core + 1;
+                bool idle = false;
+                for (int k = first; k < last && !idle; ++k) {
+                    idle = cores[k].running == -1;
+                }
+                int victim = -1;
+                for (int k = first; k < last && !idle; ++k) {
+                    settle(k, now);
+                    int running = cores[k].running;
+                    // Of two processes it beats, the weaker is the one the other would preempt
+                    if (queue.preempts(slot, running, now) &&
+                        (victim == -1 || queue.preempts(cores[victim].running, running, now))) {
+                        victim = k;
+                    }
+                }
+                if (victim != -1) {
+                    sim_core& c = cores[victim];
+                    queue.preempted(c.running, false);
+                    queue.ready(c.running, now);
+                    c.running = -1;
+                    c.generation++;
+                }
+
+                more_arrivals = source.next(pending);
+                if (more_arrivals) {
+                    events.push(sim_event{std::max(pending.arrival, now), sim_event::arrival, 0});
+                }
+            } else {
+                // Push migration: the core with the most work hands half the difference to the one with the least
+                auto load = [&](int core) { return queues[core]->queued() + (cores[core].running != -1 ? 1 : 0); };
+                int busiest = 0;
+                int idlest = 0;
+                for (int core = 1; core < num_cores; ++core) {
+                    if (load(core) > load(busiest)) {
+                        busiest = core;
+                    }
+                    if (load(core) < load(idlest)) {
+                        idlest = core;
+                    }
+                }
+                for (size_t moves = (load(busiest) - load(idlest)) / 2; moves > 0; --moves) {
+                    int slot = queues[busiest]->steal(now);
+                    if (slot == -1) {
+                        break;
+                    }
+                    queues[idlest]->migrate(slot, *queues[busiest], now);
+                    home[slot] = idlest;
+                    summary.migrations++;
+                }
+                if (live > 0 || more_arrivals) {
+                    events.push(sim_event{now + smp.balance_interval, sim_event::balance, 0});
+                }
+            }
+        }
+
+        for (const std::pair<int, int>& stopped : expired) {
+            scheduler& queue = queue_of(stopped.first);
+            queue.preempted(stopped.second, true);
+            queue.ready(stopped.second, now);
+        }
+        expired.clear();
+
+        // Give every idle core the next process from its queue, stealing if it has none
+        for (int core = 0; core < num_cores; ++core) {
+            sim_core& c = cores[core];
+            if (c.running != -1) {
+                continue;
+            }
+            scheduler& queue = queue_of(core);
+            int slot = queue.next(now);
+            if (slot == -1 && smp.balancer == balance_mode::steal && num_cores > 1) {
+                // Scan for a victim from a random starting core, then adopt the stolen process
+                int start = static_cast<int>(victim_rng() % num_cores);
+                int victim = -1;
+                for (int k = 0; k < num_cores && slot == -1; ++k) {
+                    victim = (start + k) % num_cores;
+                    if (victim != core && queues[victim]->queued() > 0) {
+                        slot = queues[victim]->steal(now);
+                    }
+                }
+                if (slot != -1) {
+                    queue.migrate(slot, *queues[victim], now);
+                    slot = queue.next(now);
+                }
+            }
+            if (slot == -1) {
+                continue;
+            }
+
+            if (home[slot] != -1 && home[slot] != core) {
+                summary.migrations++;
+            }
+            home[slot] = core;
+            if (table.first_run[slot] == -1) {
+                table.first_run[slot] = now;
+            }
+            table.dispatched[slot] = now;
+            c.running = slot;
+            c.run_start = now;
+            if (table.id[slot] != c.last_id) {
+                summary.totals.context_switches++;
+                c.last_id = table.id[slot];
+            }
+            if (observer) {
+                observer->dispatched(table, slot, now);
+            }
+            sim_time run = std::min(table.remaining[slot], queue.slice(slot));
+            sim_event stop{now + run, sim_event::cpu, ++c.generation};
+            stop.core = core;
+            events.push(stop);
+        }
+    }
+
+    return summary;
+}
+
+/**
+ * A workload held in memory, e.g. one drawn with rand() for the fcfs command.
+ */
+class vector_workload : public workload_source {
+public:
+    explicit vector_workload(const std::vector<sim_process>& processes) : processes(processes) {}
+    bool next(sim_process& process) override {
+        if (position == processes.size()) {
+            return false;
+        }
+        process = processes[position++];
+        return true;
+    }
+
+private:
+    const std::vector<sim_process>& processes;
+    size_t position = 0;
+};
+
+/**
+ * A random workload generated on the fly: bursts of 1-100 ms, priorities 0-9, and
+ * exponentially distributed gaps between arrivals (a Poisson arrival process).
+ */
+class random_workload : public workload_source {
+public:
+    random_workload(int64_t count, sim_time mean_interarrival, uint64_t seed)
+        : remaining(count), mean_interarrival(mean_interarrival), rng(seed), burst_dist(1, 100),
+          priority_dist(0, 9), gap_dist(mean_interarrival > 0 ? 1.0 / mean_interarrival : 1.0) {}
+    bool next(sim_process& process) override {
+        if (remaining == 0) {
+            return false;
+        }
+        remaining--;
+        process.arrival = static_cast<sim_time>(arrival);
+        process.burst = burst_dist(rng);
+        process.priority = priority_dist(rng);
+        if (mean_interarrival > 0) {
+            arrival += gap_dist(rng);
+        }
+        return true;
+    }
+
+private:
+    int64_t remaining;
+    sim_time mean_interarrival;
+    double arrival = 0.0;
+    std::mt19937_64 rng;
+    std::uniform_int_distribution<sim_time> burst_dist;
+    std::uniform_int_distribution<int> priority_dist;
+    std::exponential_distribution<double> gap_dist;
+};
+
+/**
+ * Prints the fcfs command's "Executing Process" line as each process is dispatched.
+ */
+class fcfs_trace : public sim_observer {
+public:
+    explicit fcfs_trace(trace_buffer& out) : out(out) {}
+    void dispatched(const process_table& table, int slot, sim_time now) override {
+        out.printf("Executing Process %lld (Burst Time: %lld ms)\n", static_cast<long long>(table.id[slot] + 1),
+                   static_cast<long long>(table.burst[slot]));
+    }
+
+private:
+    trace_buffer& out;
+};
+
+/**
+ * Prints one row per process, in completion order, for 'sched -v'.
+ */
+class completion_trace : public sim_observer {
+public:
+    explicit completion_trace(trace_buffer& out) : out(out) {}
+    void completed(const process_table& table, int slot, sim_time now) override {
+        out.printf("%5lld %9lld %6lld %5d %10lld %11lld\n", static_cast<long long>(table.id[slot] + 1),
+                   static_cast<long long>(table.arrival[slot]), static_cast<long long>(table.burst[slot]),
+                   table.priority[slot], static_cast<long long>(table.first_run[slot]), static_cast<long long>(now));
+    }
+
+private:
+    trace_buffer& out;
+};
+
+bool redirect_stdout(const std::vector<std::string>& tokens, int& saved_stdout) {
+    saved_stdout = -1;
+
+    // Check for output redirection
+    std::string output_file;
+    if (!find_output_file(tokens, output_file)) {
+        return false;
+    }
+    if (output_file.empty()) {
+        return true;
+    }
+
+    // If an output file is specified, open it for writing
+    int output_fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (output_fd == -1) {
+        std::cerr << "Couldn't open: " << output_file.c_str() << std::endl;
+        return false;
+    }
+
+    // Store the original stdout file descriptor, then redirect stdout to the output file
+    std::cout.flush();
+    saved_stdout = dup(STDOUT_FILENO);
+    dup2(output_fd, STDOUT_FILENO);
+
+    // Close the output file descriptor since stdout is redirected
+    close(output_fd);
+    return true;
+}
+
+void restore_stdout(int saved_stdout) {
+    std::cout.flush();
+    if (saved_stdout == -1) {
+        return;
+    }
+
+    // Reset the output file descriptor to stdout
+    dup2(saved_stdout, STDOUT_FILENO);
+
+    // Close the duplicated file descriptor for the original stdout
+    close(saved_stdout);
+}
+
+void fcfs_simulation(const std::vector<std::string>& tokens) {
+    // Initialize the number of processes to the default value
+    int num_processes = 5;
+
+    // Check if a number of processes is specified in tokens
+    if (tokens.size() > 1) {
+        // Check if the second token is not a redirection token
+        if (tokens[1].find(">") != 0) {
+            try {
+                // Attempt to parse the second token as the number of processes
+                num_processes = std::stoi(tokens[1]);
+            } catch (const std::exception& e) {
+                // Handle the exception if parsing fails
+                std::cerr << "Invalid number of processes." << std::endl;
+                return; // Return from the function in case of an error
+            }
+        }
+    }
+    if (num_processes <= 0) {
+        std::cerr << "Invalid number of processes." << std::endl;
+        return;
+    }
+
+    // Seed the random number generator, then draw a burst time for each process; all
+    // processes arrive at time 0
+    srand(10);
+    std::vector<sim_process> processes(num_processes);
+    for (sim_process& process : processes) {
+        process.arrival = 0;
+        process.burst = rand() % 100 + 1;
+        process.priority = 0;
+    }
+
+    int saved_stdout;
+    if (!redirect_stdout(tokens, saved_stdout)) {
+        return;
+    }
+
+    // Print a message indicating the start of the simulation
+    std::cout << "FCFS CPU scheduling simulation with " << num_processes << " processes" << std::endl;
+
+    // Run the workload through the FCFS policy, printing each process as it is dispatched
+    sim_summary summary;
+    {
+        trace_buffer out(STDOUT_FILENO);
+        fcfs_trace trace(out);
+        vector_workload source(processes);
+        fcfs_scheduler policy;
+        summary = simulate(source, policy, &trace);
+    }
+
+    // Calculate and display the average waiting time
+    double average_waiting_time = static_cast<double>(summary.total_waiting) / num_processes;
+
+    // Print the total and average waiting times
+    std::cout << "Total waiting time in the ready queue: " << summary.total_waiting << " ms" << std::endl;
+    std::cout << "Average waiting time in the ready queue: " << average_waiting_time << " ms" << std::endl;
+
+    restore_stdout(saved_stdout);
+}
+
+/**
+ * Parses the value that follows an option flag in the sched command.
  *
  * @param tokens A vector of strings representing the command tokens.
+ * @param i The index of the flag; advanced past the value.
+ * @param value Receives the value.
+ * @return false (after printing an error) if the value is missing, not a number or negative.
  */
-void execute_command(const std::vector<std::string>& tokens);
+static bool parse_option_value(const std::vector<std::string>& tokens, size_t& i, int64_t& value) {
+    if (i + 1 >= tokens.size()) {
+        std::cerr << "Missing value after " << tokens[i] << "." << std::endl;
+        return false;
+    }
+    try {
+        value = std::stoll(tokens[++i]);
+    } catch (const std::exception& e) {
+        value = -1;
+    }
+    if (value < 0) {
+        std::cerr << "Invalid value for " << tokens[i - 1] << ": " << tokens[i] << std::endl;
+        return false;
+    }
+    return true;
+}
 
 /**
- * Redirects program output to a specified file if a redirection operator '>' is found in the tokens.
- *
- * @param tokens A vector of strings representing the command tokens.
+ * The workload of the sched command: a trace file, or a random one.
  */
-void redirect_output(const std::vector<std::string>& tokens);
+struct sched_workload {
+    std::string trace_path;         // Replayed if not empty
+    int64_t num_processes = 1000;   // The rest describe the random workload
+    int64_t mean_interarrival = 60;
+    int64_t seed = 10;
+
+    /**
+     * Creates the workload afresh, so that every policy sees the same processes.
+     *
+     * @return The workload, or nullptr (after printing an error) if the trace cannot be opened.
+     */
+    std::unique_ptr<workload_source> open() const {
+        if (trace_path.empty()) {
+            return std::unique_ptr<workload_source>(new random_workload(num_processes, mean_interarrival, seed));
+        }
+        std::unique_ptr<trace_workload> trace(new trace_workload());
+        if (!trace->open(trace_path)) {
+            return nullptr;
+        }
+        return std::move(trace);
+    }
 
+    /**
+     * @return A description for the heading of the results.
+     */
+    std::string describe() const {
+        std::ostringstream oss;
+        if (trace_path.empty()) {
+            oss << num_processes << " processes, bursts 1-100 ms, mean interarrival " << mean_interarrival << " ms";
+        } else {
+            oss << "trace " << trace_path;
+        }
+        return oss.str();
+    }
+};
 
 /**
- * Simulates First-Come-First-Served (FCFS) CPU scheduling for a given number of processes.
+ * Runs the sched command's policies on several cores and prints a table of results.
  *
- * @param tokens A vector of strings representing the command tokens.
+ * @param policies The policies to compare.
+ * @param workload The workload.
+ * @param options Tunables for the policies.
+ * @param smp The number of cores and the load balancer.
+ * @param verbose Whether to print a row per process.
+ * @param tokens The command tokens, for output redirection.
  */
-void fcfs_simulation(const std::vector<std::string>& tokens);
+static void smp_simulation(const std::vector<std::string>& policies, const sched_workload& workload,
+                           const sched_options& options, const smp_options& smp, bool verbose,
+                           const std::vector<std::string>& tokens) {
+    static const char* const balancer_names[] = {"none", "global", "push", "steal"};
 
-int main() {
-    // Start an infinite loop for the shell
-    while (true) {
-        try {
-            // Print the shell prompt
-            std::cout << "myshell> ";
-            
-            // Read user input into a string
-            std::string user_input;
-            std::getline(std::cin, user_input);
+    int saved_stdout;
+    if (!redirect_stdout(tokens, saved_stdout)) {
+        return;
+    }
 
-            // Handle empty input by continuing to the next iteration
-            if (user_input.empty()) {
-                continue;
-            }
+    std::cout << "Scheduling simulation: " << workload.describe() << ", " << smp.cores << " cores ("
+              << balancer_names[static_cast<int>(smp.balancer)] << " balancing), quantum " << options.quantum
+              << " ms, seed " << workload.seed << std::endl;
+    std::cout << std::left << std::setw(8) << "policy" << std::right << std::setw(12) << "avg_wait" << std::setw(16)
+              << "avg_turnaround" << std::setw(10) << "tat_p50" << std::setw(10) << "tat_p99" << std::setw(10)
+              << "tat_p999" << std::setw(10) << "resp_p99" << std::setw(8) << "util%" << std::setw(12)
+              << "migrations" << std::setw(10) << "switches" << std::setw(10) << "Mproc/s" << std::endl;
 
-            // Tokenize the user input
-            std::istringstream iss(user_input);
-            std::vector<std::string> tokens;
-            std::string token;
+    for (const std::string& name : policies) {
+        std::unique_ptr<workload_source> source = workload.open();
+        if (!source) {
+            break;
+        }
 
-            // Split the user input into tokens and store them in a vector
-            while (iss >> token) {
-                tokens.push_back(token);
-            }
+        if (verbose) {
+            std::cout << name << ":" << std::endl << "  pid  arrival  burst  prio  first_run  completion"
+                      << std::endl;
+        }
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        smp_summary result;
+        {
+            trace_buffer out(STDOUT_FILENO);
+            completion_trace trace(out);
+            result = simulate_smp(*source, name, options, smp, verbose ? &trace : nullptr);
+        }
+        double wall_us = elapsed_us(start);
 
-            // Check for special commands
-            if (tokens[0] == "quit" || tokens[0] == "q") {
-                // If the user entered 'quit' or 'q', exit the shell
-                break;
-            } else if (tokens[0] == "fcfs") {
-                // If the user entered 'fcfs', call the fcfs_simulation function
-                fcfs_simulation(tokens);
-            } else {
-                // If it's not a special command, execute the entered command
-                execute_command(tokens);
+        // Utilization is each core's busy time over the makespan
+        const sim_summary& summary = result.totals;
+        double n = static_cast<double>(summary.processes);
+        std::vector<double> utilization;
+        double total_utilization = 0.0;
+        for (sim_time busy : result.busy) {
+            utilization.push_back(summary.makespan > 0 ? 100.0 * busy / summary.makespan : 0.0);
+            total_utilization += utilization.back();
+        }
+
+        std::cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << summary.total_waiting / n << std::setw(16) << summary.total_turnaround / n
+                  << std::setw(10) << result.turnaround.percentile(50) << std::setw(10)
+                  << result.turnaround.percentile(99) << std::setw(10) << result.turnaround.percentile(99.9)
+                  << std::setw(10) << result.response.percentile(99) << std::setprecision(1) << std::setw(8)
+                  << total_utilization / smp.cores << std::setw(12) << result.migrations << std::setw(10)
+                  << summary.context_switches << std::setprecision(2) << std::setw(10)
+                  << (wall_us > 0.0 ? n / wall_us : 0.0) << std::endl;
+
+        // Per-core utilization, 16 cores to a line
+        std::cout << std::setprecision(1);
+        for (size_t core = 0; core < utilization.size(); ++core) {
+            if (core % 16 == 0) {
+                std::cout << (core == 0 ? "  util% " : "\n        ");
             }
-        } catch (const std::exception& e) {
-            // Handle exceptions and display error messages
-            std::cerr << e.what() << std::endl;
+            std::cout << std::setw(6) << utilization[core];
         }
+        std::cout << std::endl;
     }
+    std::cout.unsetf(std::ios::floatfield);
 
-    // Exit the shell
-    return 0;
+    restore_stdout(saved_stdout);
 }
 
+void sched_simulation(const std::vector<std::string>& tokens) {
+    std::vector<std::string> policies = {"fcfs", "sjf", "srtf", "prio", "rr", "mlfq"};
+    sched_workload workload;
+    bool verbose = false;
+    sched_options options;
+    smp_options smp;
+    int64_t num_cores = 1;
 
-void execute_command(const std::vector<std::string>& tokens) {
-    // Create a child process
-    pid_t pid = fork();
+    // Parse the options, stopping at any output redirection
+    for (size_t i = 1; i < tokens.size() && tokens[i].find(">") != 0; ++i) {
+        bool ok = true;
+        if (tokens[i] == "-p" && i + 1 < tokens.size()) {
+            std::string list = tokens[++i];
+            if (list != "all") {
+                policies.clear();
+                std::istringstream iss(list);
+                std::string name;
+                while (std::getline(iss, name, ',')) {
+                    if (!make_scheduler(name, options)) {
+                        std::cerr << "Unknown policy: " << name << std::endl;
+                        return;
+                    }
+                    policies.push_back(name);
+                }
+            }
+        } else if (tokens[i] == "-n") {
+            ok = parse_option_value(tokens, i, workload.num_processes);
+        } else if (tokens[i] == "-i") {
+            ok = parse_option_value(tokens, i, workload.mean_interarrival);
+        } else if (tokens[i] == "-t" && i + 1 < tokens.size()) {
+            workload.trace_path = tokens[++i];
+        } else if (tokens[i] == "-q") {
+            ok = parse_option_value(tokens, i, options.quantum);
+        } else if (tokens[i] == "-a") {
+            ok = parse_option_value(tokens, i, options.aging);
+        } else if (tokens[i] == "-b") {
+            ok = parse_option_value(tokens, i, options.boost);
+        } else if (tokens[i] == "-s") {
+            ok = parse_option_value(tokens, i, workload.seed);
+        } else if (tokens[i] == "-c") {
+            ok = parse_option_value(tokens, i, num_cores);
+        } else if (tokens[i] == "-l" && i + 1 < tokens.size()) {
+            if (!parse_balance_mode(tokens[++i], smp.balancer)) {
+                std::cerr << "Unknown load balancer: " << tokens[i] << std::endl;
+                return;
+            }
+        } else if (tokens[i] == "-m") {
+            ok = parse_option_value(tokens, i, smp.balance_interval);
+        } else if (tokens[i] == "-v") {
+            verbose = true;
+        } else {
+            std::cerr << "Usage: sched [-p fcfs,sjf,srtf,prio,rr,mlfq|all] [-n processes] [-i mean_interarrival]"
+                      << " [-t trace] [-q quantum] [-a aging] [-b boost] [-s seed] [-c cores] [-l none|global|push|steal]"
+                      << " [-m balance_interval] [-v] [> file]" << std::endl;
+            return;
+        }
+        if (!ok) {
+            return;
+        }
+    }
+    if (workload.num_processes <= 0 || options.quantum <= 0 || options.aging <= 0 || options.boost <= 0) {
+        std::cerr << "The process count, quantum, aging and boost must be positive." << std::endl;
+        return;
+    }
+    if (num_cores <= 0 || num_cores > 4096 || smp.balance_interval <= 0) {
+        std::cerr << "The core count must be 1-4096 and the balance interval positive." << std::endl;
+        return;
+    }
+    smp.cores = static_cast<int>(num_cores);
+    smp.seed = workload.seed;
 
-    // Check for errors in fork()
-    if (pid == -1) {
-        std::cerr << "Fork Error" << std::endl;
-    } else if (pid == 0) {
-        // Child process
-        // Handle output redirection if the '>' operator is present in tokens
-        redirect_output(tokens);
+    // Check the trace opens before any output is redirected
+    if (!workload.open()) {
+        return;
+    }
+    if (smp.cores > 1) {
+        smp_simulation(policies, workload, options, smp, verbose, tokens);
+        return;
+    }
 
-        // Create a vector to store the command arguments
-        std::vector<char*> args;
+    int saved_stdout;
+    if (!redirect_stdout(tokens, saved_stdout)) {
+        return;
+    }
 
-        // Iterate through tokens and construct the argument list, excluding redirection
-        for (const std::string& token : tokens) {
-            // If the token starts with '>', stop processing (redirection handled earlier)
-            if (token.find(">") == 0) {
-                break;
-            }
+    std::cout << "Scheduling simulation: " << workload.describe() << ", quantum " << options.quantum << " ms, seed "
+              << workload.seed << std::endl;
+    std::cout << std::left << std::setw(8) << "policy" << std::right << std::setw(12) << "avg_wait" << std::setw(16)
+              << "avg_turnaround" << std::setw(14) << "avg_response" << std::setw(14) << "throughput/s"
+              << std::setw(13) << "makespan" << std::setw(10) << "switches" << std::setw(10) << "Mproc/s"
+              << std::endl;
 
-            // Add the token as a C-style string to the argument list
-            args.push_back(const_cast<char*>(token.c_str()));
+    for (const std::string& name : policies) {
+        // Every policy sees the same workload, regenerated from the same seed or reread from the trace
+        std::unique_ptr<workload_source> source = workload.open();
+        if (!source) {
+            break;
         }
+        std::unique_ptr<scheduler> policy = make_scheduler(name, options);
 
-        // Add a nullptr at the end of the argument list to mark the end
-        args.push_back(nullptr);
+        if (verbose) {
+            std::cout << name << ":" << std::endl << "  pid  arrival  burst  prio  first_run  completion"
+                      << std::endl;
+        }
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        sim_summary summary;
+        {
+            trace_buffer out(STDOUT_FILENO);
+            completion_trace trace(out);
+            summary = simulate(*source, *policy, verbose ? &trace : nullptr);
+        }
+        double wall_us = elapsed_us(start);
 
-        // Execute the command specified by the argument list
-        execvp(args[0], args.data());
+        double n = static_cast<double>(summary.processes);
+        std::cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << summary.total_waiting / n << std::setw(16) << summary.total_turnaround / n
+                  << std::setw(14) << summary.total_response / n << std::setw(14)
+                  << (summary.makespan > 0 ? n * 1000.0 / summary.makespan : 0.0) << std::setw(13)
+                  << summary.makespan << std::setw(10) << summary.context_switches << std::setw(10)
+                  << (wall_us > 0.0 ? n / wall_us : 0.0) << std::endl;
+    }
+    std::cout.unsetf(std::ios::floatfield);
 
-        // If execvp() fails, print an error message and exit the child process
-        std::cerr << "Couldn't execute: " << args[0] << std::endl;
-        exit(EXIT_FAILURE);
-    } else {
-        // Parent process
-        int status;
+    restore_stdout(saved_stdout);
+}
 
-        // Wait for the child process to complete
-        waitpid(pid, &status, 0);
+/**
+ * xoshiro256**: a small, fast generator with 256 bits of state. Each sweep run gets its own,
+ * seeded through splitmix64 from the sweep seed and the run's index, so a run's workload does
+ * not depend on which thread executes it or in what order.
+ */
+class xoshiro256 {
+public:
+    explicit xoshiro256(uint64_t seed) {
+        for (uint64_t& word : state) {
+            word = splitmix64(seed);
+        }
     }
-}
 
-void redirect_output(const std::vector<std::string>& tokens) {
-    int output_fd = STDOUT_FILENO;
-    bool found_redirect = false;
+    uint64_t operator()() {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
 
-    // Iterate through the 'tokens' vector using an index 'i'
-    for (size_t i = 0; i < tokens.size(); ++i) {
-        // Check if the current token starts with '>'
-        if (tokens[i].find(">") == 0) {
-            // If there are more tokens after the current one
-            if (i + 1 < tokens.size()) {
-                // Get a reference to the next token
-                const std::string& next_token = tokens[i + 1];
-
-                // Open the specified file for writing
-                output_fd = open(next_token.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
-                if (output_fd == -1) {
-                    std::cerr << "Couldn't open: " << next_token.c_str() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
+    /**
+     * @return A uniform double in [0, 1), from the top 53 bits.
+     */
+    double uniform() { return ((*this)() >> 11) * (1.0 / 9007199254740992.0); }
 
-                // Set a flag to indicate that a redirection operator was found and exit the loop
-                found_redirect = true;
-                break;
-            } else {
-                // Get the part of the token that follows '>'
-                const std::string& output_filename = tokens[i].substr(1);
-
-                // Check if the extracted filename is empty
-                if (output_filename.empty()) {
-                    // Error message for a missing output file name
-                    std::cerr << "Missing output file name after '>'." << std::endl;
-                    exit(EXIT_FAILURE);
-                }
+    /**
+     * Advances a splitmix64 state and returns its next output.
+     */
+    static uint64_t splitmix64(uint64_t& x) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
 
-                // Open the specified file for writing
-                output_fd = open(output_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
-                if (output_fd == -1) {
-                    std::cerr << "Couldn't open: " << output_filename.c_str() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
 
-                // Set a flag to indicate that a redirection operator was found and exit the loop
-                found_redirect = true;
-                break;
+    uint64_t state[4];
+};
+
+/**
+ * A distribution of burst times for the sweep command. The parametric ones all have a mean
+ * of about 50 ms, like the 1-100 ms uniform bursts of the other commands.
+ */
+struct burst_model {
+    enum kind_t { uniform, exponential, pareto, trace };
+
+    std::string name;
+    kind_t kind = uniform;
+    std::shared_ptr<const std::vector<sim_time>> samples; // For trace: bursts to resample from
+
+    /**
+     * Draws one burst time, at least 1 ms.
+     */
+    sim_time draw(xoshiro256& rng) const {
+        double u = rng.uniform();
+        double burst;
+        switch (kind) {
+        case exponential:
+            burst = -50.0 * std::log1p(-u);
+            break;
+        case pareto:
+            // Shape 1.5, scale chosen for a mean of 50: heavy-tailed, with infinite variance
+            burst = (50.0 / 3.0) / std::pow(1.0 - u, 1.0 / 1.5);
+            break;
+        case trace:
+            return (*samples)[static_cast<size_t>(u * samples->size())];
+        default:
+            return 1 + static_cast<sim_time>(u * 100);
+        }
+        return std::max<sim_time>(1, std::llround(std::min(burst, 1e15)));
+    }
+};
+
+/**
+ * Looks up a burst distribution for the sweep command by name. "trace:file" reads burst times
+ * from a file, one per line; with several comma-separated fields per line (arrival,burst,priority)
+ * the second is used. Lines starting with '#' are ignored.
+ *
+ * @param name The name.
+ * @param model Receives the distribution.
+ * @return false (after printing an error) if the name is unknown or the trace is unusable.
+ */
+static bool parse_burst_model(const std::string& name, burst_model& model) {
+    model.name = name;
+    if (name == "uniform") {
+        model.kind = burst_model::uniform;
+    } else if (name == "exp") {
+        model.kind = burst_model::exponential;
+    } else if (name == "pareto") {
+        model.kind = burst_model::pareto;
+    } else if (name.compare(0, 6, "trace:") == 0) {
+        std::ifstream file(name.substr(6));
+        if (!file) {
+            std::cerr << "Could not open trace: " << name.substr(6) << std::endl;
+            return false;
+        }
+        std::shared_ptr<std::vector<sim_time>> samples(new std::vector<sim_time>());
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::vector<std::string> fields;
+            std::istringstream iss(line);
+            std::string field;
+            while (std::getline(iss, field, ',')) {
+                fields.push_back(field);
+            }
+            try {
+                sim_time burst = std::stoll(fields.size() >= 2 ? fields[1] : fields[0]);
+                if (burst > 0) {
+                    samples->push_back(burst);
+                }
+            } catch (const std::exception& e) {
+                // Skip headers and malformed lines
             }
         }
+        if (samples->empty()) {
+            std::cerr << "No burst times in trace: " << name.substr(6) << std::endl;
+            return false;
+        }
+        model.kind = burst_model::trace;
+        model.samples = samples;
+        model.name = "trace";
+    } else {
+        std::cerr << "Unknown burst distribution: " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * A random workload for one sweep run: bursts from a burst model, priorities 0-9 and Poisson
+ * arrivals, all drawn from the run's own generator.
+ */
+class sweep_workload : public workload_source {
+public:
+    sweep_workload(int64_t count, sim_time mean_interarrival, const burst_model& model, uint64_t seed)
+        : remaining(count), mean_interarrival(mean_interarrival), model(model), rng(seed) {}
+    bool next(sim_process& process) override {
+        if (remaining == 0) {
+            return false;
+        }
+        remaining--;
+        process.arrival = static_cast<sim_time>(arrival);
+        process.burst = model.draw(rng);
+        process.priority = static_cast<int>(rng() % 10);
+        arrival += -mean_interarrival * std::log1p(-rng.uniform());
+        return true;
     }
 
-    // If redirection was requested and the output file descriptor is not the standard output (STDOUT_FILENO)
-    if (found_redirect && output_fd != STDOUT_FILENO) {
-        // Duplicate the output file descriptor to standard output (STDOUT_FILENO)
-        // This redirects program output to the specified file
-        dup2(output_fd, STDOUT_FILENO);
+private:
+    int64_t remaining;
+    sim_time mean_interarrival;
+    const burst_model& model;
+    xoshiro256 rng;
+    double arrival = 0.0;
+};
+
+/**
+ * The averages one sweep run produced.
+ */
+struct sweep_result {
+    double wait = 0.0;
+    double turnaround = 0.0;
+    double response = 0.0;
+};
+
+/**
+ * Accumulates a sample's mean and variance with Welford's method.
+ */
+struct running_stats {
+    int64_t n = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
 
-        // Close the original output file descriptor since it's no longer needed
-        close(output_fd);
+    void add(double x) {
+        n++;
+        double delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
     }
-}
 
-void fcfs_simulation(const std::vector<std::string>& tokens) {
-    // Initialize the number of processes to the default value
-    int num_processes = 5;
+    /**
+     * @return The half-width of a 95% confidence interval for the mean, using Student's t
+     *         for small samples.
+     */
+    double ci95() const {
+        static const double t_table[] = {0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+                                         2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+                                         2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+                                         2.042};
+        if (n < 2) {
+            return 0.0;
+        }
+        int64_t df = n - 1;
+        double t = df <= 30 ? t_table[df] : 1.96;
+        return t * std::sqrt(m2 / df / n);
+    }
+};
 
-    // Check if a number of processes is specified in tokens
-    if (tokens.size() > 1) {
-        // Check if the second token is not a redirection token
-        if (tokens[1] != ">") {
-            try {
-                // Attempt to parse the second token as the number of processes
-                num_processes = std::stoi(tokens[1]);
-            } catch (const std::exception& e) {
-                // Handle the exception if parsing fails
-                std::cerr << "Invalid number of processes." << std::endl;
-                return; // Return from the function in case of an error
+void sweep_simulation(const std::vector<std::string>& tokens) {
+    std::vector<std::string> policies = {"fcfs", "sjf", "srtf", "prio", "rr", "mlfq"};
+    std::vector<burst_model> models;
+    std::vector<int64_t> counts;
+    int64_t replications = 100;
+    int64_t threads = std::max(1u, std::thread::hardware_concurrency());
+    int64_t mean_interarrival = 60;
+    int64_t seed = 10;
+    int64_t num_cores = 1;
+    sched_options options;
+    smp_options smp;
+
+    // Parse the options, stopping at any output redirection
+    for (size_t i = 1; i < tokens.size() && tokens[i].find(">") != 0; ++i) {
+        bool ok = true;
+        if (tokens[i] == "-p" && i + 1 < tokens.size()) {
+            std::string list = tokens[++i];
+            if (list != "all") {
+                policies.clear();
+                std::istringstream iss(list);
+                std::string name;
+                while (std::getline(iss, name, ',')) {
+                    if (!make_scheduler(name, options)) {
+                        std::cerr << "Unknown policy: " << name << std::endl;
+                        return;
+                    }
+                    policies.push_back(name);
+                }
+            }
+        } else if (tokens[i] == "-d" && i + 1 < tokens.size()) {
+            std::istringstream iss(tokens[++i]);
+            std::string name;
+            while (std::getline(iss, name, ',')) {
+                models.emplace_back();
+                if (!parse_burst_model(name, models.back())) {
+                    return;
+                }
+            }
+        } else if (tokens[i] == "-n" && i + 1 < tokens.size()) {
+            std::istringstream iss(tokens[++i]);
+            std::string count;
+            while (std::getline(iss, count, ',')) {
+                int64_t value = -1;
+                try {
+                    value = std::stoll(count);
+                } catch (const std::exception& e) {
+                    value = -1;
+                }
+                if (value <= 0) {
+                    std::cerr << "Invalid process count: " << count << std::endl;
+                    return;
+                }
+                counts.push_back(value);
+            }
+        } else if (tokens[i] == "-r") {
+            ok = parse_option_value(tokens, i, replications);
+        } else if (tokens[i] == "-j") {
+            ok = parse_option_value(tokens, i, threads);
+        } else if (tokens[i] == "-i") {
+            ok = parse_option_value(tokens, i, mean_interarrival);
+        } else if (tokens[i] == "-q") {
+            ok = parse_option_value(tokens, i, options.quantum);
+        } else if (tokens[i] == "-c") {
+            ok = parse_option_value(tokens, i, num_cores);
+        } else if (tokens[i] == "-l" && i + 1 < tokens.size()) {
+            if (!parse_balance_mode(tokens[++i], smp.balancer)) {
+                std::cerr << "Unknown load balancer: " << tokens[i] << std::endl;
+                return;
             }
+        } else if (tokens[i] == "-s") {
+            ok = parse_option_value(tokens, i, seed);
+        } else {
+            std::cerr << "Usage: sweep [-p fcfs,sjf,srtf,prio,rr,mlfq|all] [-d uniform,exp,pareto,trace:file]"
+                      << " [-n count,count,...] [-r replications] [-j threads] [-i mean_interarrival] [-q quantum]"
+                      << " [-c cores] [-l none|global|push|steal] [-s seed] [> file]" << std::endl;
+            return;
+        }
+        if (!ok) {
+            return;
         }
     }
+    if (models.empty()) {
+        for (const char* name : {"uniform", "exp", "pareto"}) {
+            models.emplace_back();
+            parse_burst_model(name, models.back());
+        }
+    }
+    if (counts.empty()) {
+        counts.push_back(1000);
+    }
+    if (replications <= 0 || threads <= 0 || options.quantum <= 0 || num_cores <= 0 || num_cores > 4096) {
+        std::cerr << "The replications, threads, quantum and cores must be positive (at most 4096 cores)." << std::endl;
+        return;
+    }
+    smp.cores = static_cast<int>(num_cores);
 
-    // Seed the random number generator
-    srand(10);
-
-    // Create a vector to store burst times for each process
-    std::vector<int> burst_times(num_processes);
+    // One cell per (policy, distribution, count); each cell runs 'replications' times. Runs are
+    // numbered so that run r of every cell sees the same workload.
+    size_t num_cells = policies.size() * models.size() * counts.size();
+    size_t num_runs = num_cells * replications;
+    std::vector<sweep_result> results(num_runs);
+    std::atomic<size_t> next_run(0);
 
-    // Store the original stdout file descriptor
-    int original_stdout = dup(STDOUT_FILENO);
+    auto worker = [&]() {
+        // Runs are claimed one at a time, so threads stay busy even when cells differ in cost
+        size_t run;
+        while ((run = next_run.fetch_add(1, std::memory_order_relaxed)) < num_runs) {
+            size_t cell = run / replications;
+            uint64_t replication = run % replications;
+            const std::string& policy_name = policies[cell / (models.size() * counts.size())];
+            const burst_model& model = models[cell / counts.size() % models.size()];
+            int64_t count = counts[cell % counts.size()];
 
-    // Check for output redirection
-    std::string output_file;
-    for (size_t i = 0; i < tokens.size(); ++i) {
-        if (tokens[i] == ">") {
-            if (i + 1 < tokens.size()) {
-                // Get the output file name after the ">" token
-                output_file = tokens[i + 1];
-                break;
+            // The workload depends only on the seed, distribution, count and replication
+            uint64_t mix = static_cast<uint64_t>(seed) ^ (replication << 32) ^ (cell % (models.size() * counts.size()));
+            sweep_workload source(count, mean_interarrival, model, xoshiro256::splitmix64(mix));
+            sim_summary summary;
+            if (smp.cores > 1) {
+                summary = simulate_smp(source, policy_name, options, smp, nullptr).totals;
+            } else {
+                std::unique_ptr<scheduler> policy = make_scheduler(policy_name, options);
+                summary = simulate(source, *policy, nullptr);
             }
+
+            double n = static_cast<double>(summary.processes);
+            results[run].wait = summary.total_waiting / n;
+            results[run].turnaround = summary.total_turnaround / n;
+            results[run].response = summary.total_response / n;
+        }
+    };
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    std::vector<std::thread> pool;
+    for (int64_t t = 1; t < std::min<int64_t>(threads, num_runs); ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    double wall_s = elapsed_us(start) / 1e6;
+
+    int saved_stdout;
+    if (!redirect_stdout(tokens, saved_stdout)) {
+        return;
+    }
+
+    std::cout << "Scheduling sweep: " << replications << " runs per cell, mean interarrival " << mean_interarrival
+              << " ms, quantum " << options.quantum << " ms, " << smp.cores << " core(s), seed " << seed << std::endl;
+    std::cout << std::left << std::setw(8) << "policy" << std::setw(9) << "bursts" << std::right << std::setw(11)
+              << "processes" << std::setw(22) << "avg_wait (95% CI)" << std::setw(22) << "avg_turnaround"
+              << std::setw(22) << "avg_response" << std::endl;
+
+    int64_t total_processes = 0;
+    for (size_t cell = 0; cell < num_cells; ++cell) {
+        running_stats wait;
+        running_stats turnaround;
+        running_stats response;
+        for (int64_t r = 0; r < replications; ++r) {
+            const sweep_result& result = results[cell * replications + r];
+            wait.add(result.wait);
+            turnaround.add(result.turnaround);
+            response.add(result.response);
         }
+        int64_t count = counts[cell % counts.size()];
+        total_processes += count * replications;
+
+        auto interval = [](const running_stats& stats) {
+            std::ostringstream oss;
+            oss << std::fixed << std::setprecision(2) << stats.mean << " +- " << stats.ci95();
+            return oss.str();
+        };
+        std::cout << std::left << std::setw(8) << policies[cell / (models.size() * counts.size())] << std::setw(9)
+                  << models[cell / counts.size() % models.size()].name << std::right << std::setw(11) << count
+                  << std::setw(22) << interval(wait) << std::setw(22) << interval(turnaround) << std::setw(22)
+                  << interval(response) << std::endl;
     }
 
-    // If an output file is specified, open it for writing
-    if (!output_file.empty()) {
-        int output_fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
-        if (output_fd == -1) {
-            std::cerr << "Couldn't open: " << output_file.c_str() << std::endl;
-            exit(EXIT_FAILURE);
+    std::cout << num_runs << " simulations of " << total_processes << " processes in " << std::fixed
+              << std::setprecision(2) << wall_s << " s on " << std::min<int64_t>(threads, num_runs) << " threads ("
+              << (wall_s > 0.0 ? total_processes / wall_s / 1e6 : 0.0) << " Mproc/s)" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+
+    restore_stdout(saved_stdout);
+}
+
+trace_workload::~trace_workload() {
+    if (data != nullptr) {
+        munmap(data, size);
+    }
+}
+
+bool trace_workload::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        std::cerr << "Couldn't open trace: " << path << " (" << strerror(errno) << ")" << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        std::cerr << "Couldn't stat trace: " << path << " (" << strerror(errno) << ")" << std::endl;
+        close(fd);
+        return false;
+    }
+
+    // An empty file is an empty workload; mmap() refuses a length of zero
+    size = static_cast<size_t>(st.st_size);
+    if (size > 0) {
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Couldn't map trace: " << path << " (" << strerror(errno) << ")" << std::endl;
+            close(fd);
+            size = 0;
+            return false;
         }
+        data = static_cast<char*>(mapping);
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
 
-        // Redirect stdout to the output file
-        dup2(output_fd, STDOUT_FILENO);
+    binary = size >= sizeof(trace_magic) && memcmp(data, trace_magic, sizeof(trace_magic)) == 0;
+    position = binary ? sizeof(trace_magic) : 0;
+    return true;
+}
 
-        // Close the output file descriptor since stdout is redirected
-        close(output_fd);
+/**
+ * Parses an optionally signed decimal number surrounded by blanks.
+ *
+ * @param p The start of the number; advanced past it and any blanks that follow.
+ * @param end The end of the line.
+ * @param value Receives the number.
+ * @return false if there are no digits.
+ */
+static bool parse_trace_field(const char*& p, const char* end, int64_t& value) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        ++p;
     }
+    bool negative = p < end && *p == '-';
+    if (negative) {
+        ++p;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+    }
+    if (negative) {
+        value = -value;
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        ++p;
+    }
+    return true;
+}
 
-    // Input burst times for each process
-    for (int i = 0; i < num_processes; ++i) {
-        burst_times[i] = rand() % 100 + 1;
+bool trace_workload::next(sim_process& process) {
+    if (binary) {
+        // Records are checked like CSV lines; a negative time would run the clock backwards
+        while (size - position >= sizeof(trace_record)) {
+            trace_record record;
+            memcpy(&record, data + position, sizeof(record));
+            position += sizeof(record);
+            if (record.arrival < 0 || record.burst < 0) {
+                skipped_lines++;
+                continue;
+            }
+            process.arrival = record.arrival;
+            process.burst = record.burst;
+            process.priority = record.priority;
+            release_consumed();
+            return true;
+        }
+        return false;
     }
 
-    // Print a message indicating the start of the simulation
-    std::cout << "FCFS CPU scheduling simulation with " << num_processes << " processes" << std::endl;
+    while (position < size) {
+        const char* line = data + position;
+        const char* end = static_cast<const char*>(memchr(line, '\n', size - position));
+        if (end == nullptr) {
+            end = data + size;
+        }
+        position = std::min(size, static_cast<size_t>(end - data) + 1);
 
-    // Initialize variables for tracking total waiting time and current time
-    int total_waiting_time = 0;
-    int current_time = 0;
+        // Headers and comments do not start with a number, and are skipped silently
+        const char* p = line;
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+        if (p == end || *p == '\r' || !((*p >= '0' && *p <= '9') || *p == '-')) {
+            continue;
+        }
 
-    // Simulate the execution of each process
-    for (int i = 0; i < num_processes; ++i) {
-        std::cout << "Executing Process " << i + 1 << " (Burst Time: " << burst_times[i] << " ms)" << std::endl;
+        int64_t arrival;
+        int64_t burst;
+        int64_t priority = 0;
+        bool ok = parse_trace_field(p, end, arrival) && p < end && *p++ == ',' && parse_trace_field(p, end, burst);
+        if (ok && p < end && *p == ',') {
+            ++p;
+            ok = parse_trace_field(p, end, priority);
+        }
+        if (!ok || p != end || arrival < 0 || burst < 0) {
+            skipped_lines++;
+            continue;
+        }
 
-        // Calculate waiting time for the current process
-        int waiting_time = current_time;
-        total_waiting_time += waiting_time;
+        process.arrival = arrival;
+        process.burst = burst;
+        process.priority = static_cast<int>(priority);
+        release_consumed();
+        return true;
+    }
+    return false;
+}
 
-        // Update current time with the burst time of the current process
-        current_time += burst_times[i];
+void trace_workload::release_consumed() {
+    // Dropping whole pages every 64 MiB keeps the madvise() calls rare
+    static const size_t release_chunk = 64 << 20;
+    if (position - released < release_chunk) {
+        return;
     }
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t boundary = position / page_size * page_size;
+    madvise(data + released, boundary - released, MADV_DONTNEED);
+    released = boundary;
+}
 
-    // Calculate and display the average waiting time
-    double average_waiting_time = static_cast<double>(total_waiting_time) / num_processes;
+void capture_child(const job& owner, const struct rusage& usage) {
+    if (!current_capture.active) {
+        return;
+    }
 
-    // Print the total and average waiting times
-    std::cout << "Total waiting time in the ready queue: " << total_waiting_time << " ms" << std::endl;
-    std::cout << "Average waiting time in the ready queue: " << average_waiting_time << " ms" << std::endl;
+    // Times in the trace are whole milliseconds; a burst rounds up so no process is free
+    long long arrival_ns = (owner.start_time.tv_sec - current_capture.start.tv_sec) * 1000000000LL +
+                           (owner.start_time.tv_nsec - current_capture.start.tv_nsec);
+    long long cpu_us = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec +
+                       usage.ru_stime.tv_usec;
+    sim_process process;
+    process.arrival = std::max(0LL, arrival_ns / 1000000);
+    process.burst = std::max(1LL, (cpu_us + 999) / 1000);
+    process.priority = 0;
+    current_capture.records.push_back(process);
+}
 
-    // Reset the output file descriptor to stdout
-    dup2(original_stdout, STDOUT_FILENO);
+void trace_command(const std::vector<std::string>& tokens) {
+    std::string usage = "Usage: trace capture file | trace stop | trace convert in.csv out.bin | trace info file";
+    if (tokens.size() == 3 && tokens[1] == "capture") {
+        if (current_capture.active) {
+            std::cerr << "A capture to " << current_capture.path << " is already running." << std::endl;
+            return;
+        }
+        current_capture = trace_capture();
+        current_capture.active = true;
+        current_capture.path = tokens[2];
+        clock_gettime(CLOCK_MONOTONIC, &current_capture.start);
+    } else if (tokens.size() == 2 && tokens[1] == "stop") {
+        if (!current_capture.active) {
+            std::cerr << "No capture is running." << std::endl;
+            return;
+        }
 
-    // Close the duplicated file descriptor for the original stdout
-    close(original_stdout);
+        // Children are reaped in exit order; a trace is in arrival order
+        std::vector<sim_process>& records = current_capture.records;
+        std::stable_sort(records.begin(), records.end(),
+                         [](const sim_process& a, const sim_process& b) { return a.arrival < b.arrival; });
+        std::ofstream file(current_capture.path);
+        file << "arrival,burst,priority\n";
+        for (const sim_process& process : records) {
+            file << process.arrival << ',' << process.burst << ',' << process.priority << '\n';
+        }
+        file.close();
+        if (!file) {
+            std::cerr << "Couldn't write trace: " << current_capture.path << std::endl;
+        } else {
+            std::cout << records.size() << " processes written to " << current_capture.path << std::endl;
+        }
+        current_capture = trace_capture();
+    } else if (tokens.size() == 4 && tokens[1] == "convert") {
+        trace_workload source;
+        if (!source.open(tokens[2])) {
+            return;
+        }
+        std::ofstream file(tokens[3], std::ios::binary);
+        file.write(trace_magic, sizeof(trace_magic));
+        sim_process process;
+        int64_t count = 0;
+        while (source.next(process)) {
+            trace_record record = {process.arrival, process.burst, process.priority, 0};
+            file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            count++;
+        }
+        file.close();
+        if (!file) {
+            std::cerr << "Couldn't write trace: " << tokens[3] << std::endl;
+            return;
+        }
+        std::cout << count << " processes converted";
+        if (source.skipped() > 0) {
+            std::cout << ", " << source.skipped() << " malformed records skipped";
+        }
+        std::cout << std::endl;
+    } else if (tokens.size() == 3 && tokens[1] == "info") {
+        trace_workload source;
+        if (!source.open(tokens[2])) {
+            return;
+        }
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        sim_process process;
+        int64_t count = 0;
+        sim_time total_burst = 0;
+        sim_time first_arrival = 0;
+        sim_time last_arrival = 0;
+        int64_t out_of_order = 0;
+        while (source.next(process)) {
+            if (count == 0) {
+                first_arrival = process.arrival;
+            } else if (process.arrival < last_arrival) {
+                out_of_order++;
+            }
+            last_arrival = std::max(last_arrival, process.arrival);
+            total_burst += process.burst;
+            count++;
+        }
+        double wall_us = elapsed_us(start);
+
+        std::cout << count << " processes, arrivals " << first_arrival << "-" << last_arrival << " ms, mean burst "
+                  << std::fixed << std::setprecision(2) << (count > 0 ? static_cast<double>(total_burst) / count : 0.0)
+                  << " ms, " << out_of_order << " out of order, " << source.skipped() << " malformed records skipped ("
+                  << (wall_us > 0.0 ? count / wall_us : 0.0) << " Mrec/s)" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+    } else {
+        std::cerr << usage << std::endl;
+    }
 }
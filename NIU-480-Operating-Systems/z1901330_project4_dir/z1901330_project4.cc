@@ -7,39 +7,70 @@ Date Due: 9/27/23
 Purpose: Solve the Reader-Writer problem using the PThreads library.
 *********************************************************************/
 #include <time.h>
+#include <sched.h>
 #include <string>
 #include <stdio.h>
+#include <atomic>
 #include <iostream>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/time.h>
 #include <semaphore.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <bits/stdc++.h>
 
 // Initialize shared string, which is a global variable shared by all threads
 char sharedString[] = "All work and no play makes Jack a dull boy.";
 
-// rw_sem is used by both readers and writers
-// cs_sem is used for protecting critical sections of readers
-sem_t rw_sem, cs_sem;
-int read_count = 0;  // Counter to track the number of readers.
+/**
+ * A reader-writer lock: any number of readers, or one writer, may hold it at a time.
+ * The implementations differ in who goes first when readers and writers compete.
+ */
+class rw_lock {
+public:
+    virtual ~rw_lock() {}
+
+    /**
+     * @return The name used to select the lock on the command line.
+     */
+    virtual const char* name() const = 0;
+
+    virtual void read_lock() = 0;
+    virtual void read_unlock() = 0;
+    virtual void write_lock() = 0;
+    virtual void write_unlock() = 0;
+};
 
 /**
- * Simulates a reader thread that reads from a shared resource.
- *
- * @param param A pointer to the reader's ID.
+ * Readers-preference: while any reader holds the lock, new readers walk straight in, so a
+ * steady stream of readers starves the writers.
  */
-void *reader(void *param) {
-    int tid = *((int *)param); // Reader ID
+class readers_pref_lock : public rw_lock {
+public:
+    /**
+     * @param trace Whether to print read_count as it changes.
+     */
+    explicit readers_pref_lock(bool trace) : trace(trace) {
+        sem_init(&rw_sem, 0, 1);  // Initialize the read-write semaphore with initial value 1.
+        sem_init(&cs_sem, 0, 1);  // Initialize the critical section semaphore with initial value 1.
+    }
+    ~readers_pref_lock() {
+        sem_destroy(&rw_sem);  // Clean up the read-write semaphore.
+        sem_destroy(&cs_sem);  // Clean up the critical section semaphore.
+    }
+    const char* name() const { return "rpref"; }
 
-    while (strlen(sharedString) > 0) {
+    void read_lock() {
         // Request permission to read
         sem_wait(&cs_sem);
 
         // Increment the read_count
         read_count++;
-        printf("read_count increments to: %d.\n", read_count);
+        if (trace) {
+            printf("read_count increments to: %d.\n", read_count);
+        }
 
         // If it's the first reader, block writers
         if (read_count == 1) {
@@ -48,16 +79,17 @@ void *reader(void *param) {
 
         // Release permission to read
         sem_post(&cs_sem);
+    }
 
-        // Read operation
-        printf("reader %d is reading ... content : %s\n", tid, sharedString);
-
+    void read_unlock() {
         // Request permission to read
         sem_wait(&cs_sem);
 
         // Decrement the read_count
         read_count--;
-        printf("read_count decrements to: %d.\n", read_count);
+        if (trace) {
+            printf("read_count decrements to: %d.\n", read_count);
+        }
 
         // If it's the last reader, allow writers
         if (read_count == 0) {
@@ -66,6 +98,869 @@ void *reader(void *param) {
 
         // Release permission to read
         sem_post(&cs_sem);
+    }
+
+    void write_lock() { sem_wait(&rw_sem); }
+    void write_unlock() { sem_post(&rw_sem); }
+
+private:
+    // rw_sem is used by both readers and writers
+    // cs_sem is used for protecting critical sections of readers
+    sem_t rw_sem, cs_sem;
+    int read_count = 0;  // Counter to track the number of readers.
+    bool trace;
+};
+
+/**
+ * Writer-preference: once a writer is waiting, new readers queue behind it on read_try,
+ * so readers can starve instead.
+ */
+class writer_pref_lock : public rw_lock {
+public:
+    writer_pref_lock() {
+        sem_init(&read_try, 0, 1);
+        sem_init(&resource, 0, 1);
+        sem_init(&reader_mutex, 0, 1);
+        sem_init(&writer_mutex, 0, 1);
+    }
+    ~writer_pref_lock() {
+        sem_destroy(&read_try);
+        sem_destroy(&resource);
+        sem_destroy(&reader_mutex);
+        sem_destroy(&writer_mutex);
+    }
+    const char* name() const { return "wpref"; }
+
+    void read_lock() {
+        // A waiting writer holds read_try, which keeps new readers out
+        sem_wait(&read_try);
+        sem_wait(&reader_mutex);
+        if (++read_count == 1) {
+            sem_wait(&resource);
+        }
+        sem_post(&reader_mutex);
+        sem_post(&read_try);
+    }
+
+    void read_unlock() {
+        sem_wait(&reader_mutex);
+        if (--read_count == 0) {
+            sem_post(&resource);
+        }
+        sem_post(&reader_mutex);
+    }
+
+    void write_lock() {
+        // The first waiting writer closes read_try; the last one to leave opens it again
+        sem_wait(&writer_mutex);
+        if (++write_count == 1) {
+            sem_wait(&read_try);
+        }
+        sem_post(&writer_mutex);
+        sem_wait(&resource);
+    }
+
+    void write_unlock() {
+        sem_post(&resource);
+        sem_wait(&writer_mutex);
+        if (--write_count == 0) {
+            sem_post(&read_try);
+        }
+        sem_post(&writer_mutex);
+    }
+
+private:
+    sem_t read_try;      // Held by writers to stop new readers
+    sem_t resource;      // Held by the writer, or by the readers as a group
+    sem_t reader_mutex;  // Protects read_count
+    sem_t writer_mutex;  // Protects write_count
+    int read_count = 0;  // Readers holding the lock
+    int write_count = 0; // Writers holding or waiting for the lock
+};
+
+/**
+ * Waits briefly in a spin loop. On x86 this is the PAUSE instruction, which frees pipeline
+ * resources for a sibling hyperthread while spinning.
+ */
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Spins until a condition holds, yielding the CPU after a while so that on a machine with more
+ * threads than cores a waiter does not burn the time slice of the thread it is waiting for.
+ *
+ * @param done Returns true once the wait is over.
+ */
+template <typename Predicate>
+static inline void spin_until(Predicate done) {
+    for (int spins = 0; !done(); ++spins) {
+        if (spins < 128) {
+            cpu_relax();
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * Fair reader-writer ticket lock (Mellor-Crummey and Scott): every thread takes a ticket and
+ * enters in ticket order, but consecutive readers overlap. Nobody starves, at the cost of
+ * readers behind a writer waiting even while other readers hold the lock.
+ */
+class ticket_rw_lock : public rw_lock {
+public:
+    const char* name() const { return "fair"; }
+
+    void read_lock() {
+        unsigned int ticket = users.fetch_add(1, std::memory_order_relaxed);
+        spin_until([&]() { return read_turn.load(std::memory_order_acquire) == ticket; });
+
+        // Let the next ticket in if it is a reader too
+        read_turn.store(ticket + 1, std::memory_order_release);
+    }
+
+    void read_unlock() { write_turn.fetch_add(1, std::memory_order_release); }
+
+    void write_lock() {
+        // write_turn counts every ticket that has left, so it reaches ours once all are gone
+        unsigned int ticket = users.fetch_add(1, std::memory_order_relaxed);
+        spin_until([&]() { return write_turn.load(std::memory_order_acquire) == ticket; });
+    }
+
+    void write_unlock() {
+        // No other thread moves read_turn while the writer holds the lock, but the reader it
+        // lets in can leave and bump write_turn at any time, so that one must be atomic
+        read_turn.store(read_turn.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        write_turn.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    std::atomic<unsigned int> users{0};      // Next ticket to hand out
+    std::atomic<unsigned int> read_turn{0};  // A reader may enter when this equals its ticket
+    std::atomic<unsigned int> write_turn{0}; // A writer may enter when this equals its ticket
+};
+
+/**
+ * Phase-fair ticket lock (PF-T, Brandenburg and Anderson): reader and writer phases alternate.
+ * A reader waits for at most one writer, and a writer for at most one reader phase and the
+ * writers ahead of it, which bounds both sides' waiting.
+ */
+class phase_fair_lock : public rw_lock {
+public:
+    const char* name() const { return "phasefair"; }
+
+    void read_lock() {
+        // The low bits of rin say whether a writer is present, and which phase it belongs to
+        unsigned int writer = rin.fetch_add(reader_increment, std::memory_order_acquire) & writer_bits;
+        if (writer != 0) {
+            spin_until([&]() { return (rin.load(std::memory_order_acquire) & writer_bits) != writer; });
+        }
+    }
+
+    void read_unlock() { rout.fetch_add(reader_increment, std::memory_order_release); }
+
+    void write_lock() {
+        // Writers queue among themselves with a ticket, then announce themselves to readers
+        // and wait for the readers already inside to drain
+        unsigned int ticket = win.fetch_add(1, std::memory_order_relaxed);
+        spin_until([&]() { return wout.load(std::memory_order_acquire) == ticket; });
+        unsigned int present = writer_present | (ticket & phase_id);
+        unsigned int readers_in = rin.fetch_add(present, std::memory_order_acquire);
+        spin_until([&]() { return rout.load(std::memory_order_acquire) == readers_in; });
+    }
+
+    void write_unlock() {
+        rin.fetch_and(~writer_bits, std::memory_order_release);
+        wout.store(wout.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    static const unsigned int reader_increment = 0x100;
+    static const unsigned int writer_bits = 0x3;
+    static const unsigned int writer_present = 0x2;
+    static const unsigned int phase_id = 0x1;
+
+    std::atomic<unsigned int> rin{0};  // Readers that have arrived, times reader_increment, plus writer bits
+    std::atomic<unsigned int> rout{0}; // Readers that have left, times reader_increment
+    std::atomic<unsigned int> win{0};  // Writer tickets handed out
+    std::atomic<unsigned int> wout{0}; // Writer tickets served
+};
+
+/**
+ * Returns a small number unique to the calling thread, handed out in the order threads first ask.
+ *
+ * @return The thread's index, from 0.
+ */
+static int thread_index() {
+    static std::atomic<int> next_index{0};
+    thread_local int index = next_index.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+/**
+ * BRAVO (Biased Locking for Reader-Writer Locks, Dice and Kogan) around another lock. While the
+ * lock is read-biased, a reader only marks its own cache-line-sized slot in a table of visible
+ * readers, so readers on different cores never write the same cache line. A writer takes the
+ * underlying lock, turns the bias off and waits until it has seen every slot empty; the bias
+ * stays off for a multiple of that revocation time, so frequent writers fall back to the
+ * underlying lock instead of paying for the scan on every write.
+ */
+class bravo_lock : public rw_lock {
+public:
+    /**
+     * @param underlying The lock used by writers and by readers while the bias is off; owned.
+     */
+    explicit bravo_lock(rw_lock* underlying) : underlying(underlying) {
+        // operator new ignores over-alignment before C++17, so the slots get their own allocation
+        void* memory = nullptr;
+        if (posix_memalign(&memory, 64, sizeof(reader_slot) * num_slots) != 0) {
+            throw std::bad_alloc();
+        }
+        slots = static_cast<reader_slot*>(memory);
+        for (int i = 0; i < num_slots; i++) {
+            new (&slots[i]) reader_slot();
+        }
+    }
+    ~bravo_lock() {
+        free(slots);
+        delete underlying;
+    }
+    bravo_lock(const bravo_lock&) = delete;
+    bravo_lock& operator=(const bravo_lock&) = delete;
+    const char* name() const { return "bravo"; }
+
+    void read_lock() {
+        if (read_bias.load(std::memory_order_acquire)) {
+            // Publish the slot, then check the bias again: a writer that turned it off in
+            // between will see the slot in its scan, or we see the bias off and back out
+            reader_slot& slot = slots[thread_index() % num_slots];
+            int empty = 0;
+            if (slot.readers.compare_exchange_strong(empty, 1, std::memory_order_seq_cst)) {
+                if (read_bias.load(std::memory_order_seq_cst)) {
+                    fast_path_held = true;
+                    return;
+                }
+                slot.readers.store(0, std::memory_order_release);
+            }
+        }
+
+        // Slow path: the underlying lock, turning the bias back on once the inhibition ends
+        underlying->read_lock();
+        fast_path_held = false;
+        if (!read_bias.load(std::memory_order_relaxed) && now_ns() >= inhibit_until.load(std::memory_order_relaxed)) {
+            read_bias.store(true, std::memory_order_release);
+        }
+    }
+
+    void read_unlock() {
+        if (fast_path_held) {
+            slots[thread_index() % num_slots].readers.store(0, std::memory_order_release);
+        } else {
+            underlying->read_unlock();
+        }
+    }
+
+    void write_lock() {
+        underlying->write_lock();
+        if (read_bias.load(std::memory_order_relaxed)) {
+            // Revoke the bias and wait for the fast-path readers to leave
+            long start = now_ns();
+            read_bias.store(false, std::memory_order_seq_cst);
+            for (int i = 0; i < num_slots; i++) {
+                reader_slot& slot = slots[i];
+                spin_until([&]() { return slot.readers.load(std::memory_order_acquire) == 0; });
+            }
+            long now = now_ns();
+            inhibit_until.store(now + (now - start) * inhibit_multiplier, std::memory_order_relaxed);
+        }
+    }
+
+    void write_unlock() { underlying->write_unlock(); }
+
+private:
+    static const int num_slots = 256;
+    static const int inhibit_multiplier = 9; // Bias stays off for 9x the revocation time
+
+    /**
+     * One visible-reader slot, alone on its cache line.
+     */
+    struct alignas(64) reader_slot {
+        std::atomic<int> readers{0};
+    };
+
+    static long now_ns() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000L + now.tv_nsec;
+    }
+
+    rw_lock* underlying;
+    std::atomic<bool> read_bias{true};
+    std::atomic<long> inhibit_until{0};
+    reader_slot* slots;
+
+    // Whether this thread's current read lock is held through its slot. One bravo_lock exists
+    // per program, so a per-thread flag is enough.
+    static thread_local bool fast_path_held;
+};
+
+thread_local bool bravo_lock::fast_path_held = false;
+
+/**
+ * A reader-writer lock on one 32-bit word, sleeping in futex(2) rather than in semaphores.
+ * An uncontended reader enters with a single atomic add and leaves with a single atomic
+ * subtract; the kernel is only entered once someone has had to sleep. The word counts waiting
+ * writers, and new readers are held back until that count drops to zero, so writers do not
+ * starve. Before sleeping, a thread spins for a while, and the
+ * spin limit grows when spinning pays off and shrinks when it does not.
+ */
+class futex_rw_lock : public rw_lock {
+public:
+    const char* name() const { return "futex"; }
+
+    void read_lock() {
+        while (true) {
+            unsigned int previous = state.fetch_add(1, std::memory_order_acquire);
+            if ((previous & (writer_held | writers_waiting)) == 0) {
+                return;
+            }
+
+            // A writer holds the lock or wants it: back out, then wait for the writers to finish
+            leave_reader();
+            wait_while([](unsigned int value) { return (value & (writer_held | writers_waiting)) != 0; });
+        }
+    }
+
+    void read_unlock() { leave_reader(); }
+
+    void write_lock() {
+        int spins = 0;
+        int limit = spin_limit.load(std::memory_order_relaxed);
+        bool counted = false;
+        while (true) {
+            unsigned int value = state.load(std::memory_order_relaxed);
+            if ((value & (writer_held | reader_mask)) == 0) {
+                // Free: take it, leaving the other waiting writers counted
+                unsigned int taken = (counted ? value - writer_waiting : value) | writer_held;
+                if (state.compare_exchange_weak(value, taken, std::memory_order_acquire)) {
+                    adapt_spin_limit(spins < limit);
+                    return;
+                }
+                continue;
+            }
+            if (!counted) {
+                counted = state.compare_exchange_weak(value, value + writer_waiting, std::memory_order_relaxed);
+                continue;
+            }
+            if (spins < limit) {
+                spins++;
+                cpu_relax();
+                continue;
+            }
+            sleep_on(value);
+        }
+    }
+
+    void write_unlock() {
+        unsigned int previous = state.fetch_and(~(writer_held | sleepers), std::memory_order_release);
+        if (previous & sleepers) {
+            futex(FUTEX_WAKE_PRIVATE, INT_MAX);
+        }
+    }
+
+private:
+    static const unsigned int writer_held = 1u << 31;    // A writer holds the lock
+    static const unsigned int sleepers = 1u << 30;       // Somebody may be asleep in futex()
+    static const unsigned int writer_waiting = 1u << 16; // One in the waiting-writer count, bits 16-29
+    static const unsigned int writers_waiting = sleepers - writer_waiting; // Nonzero: new readers wait
+    static const unsigned int reader_mask = writer_waiting - 1;
+
+    /**
+     * Drops one reader, waking the sleepers if that was the last reader a writer was waiting for.
+     */
+    void leave_reader() {
+        unsigned int value = state.fetch_sub(1, std::memory_order_release) - 1;
+        if ((value & reader_mask) == 0 && (value & sleepers) != 0) {
+            state.fetch_and(~sleepers, std::memory_order_relaxed);
+            futex(FUTEX_WAKE_PRIVATE, INT_MAX);
+        }
+    }
+
+    /**
+     * Spins, then sleeps, for as long as the state word satisfies a condition.
+     *
+     * @param blocked Returns true while the caller must keep waiting.
+     */
+    template <typename Predicate>
+    void wait_while(Predicate blocked) {
+        int limit = spin_limit.load(std::memory_order_relaxed);
+        for (int spins = 0;; spins++) {
+            unsigned int value = state.load(std::memory_order_relaxed);
+            if (!blocked(value)) {
+                adapt_spin_limit(spins < limit);
+                return;
+            }
+            if (spins < limit) {
+                cpu_relax();
+            } else {
+                sleep_on(value);
+            }
+        }
+    }
+
+    /**
+     * Marks that a thread is about to sleep and sleeps, unless the state word has changed from
+     * the value the caller saw, in which case the caller looks again.
+     *
+     * @param value The state word the caller decided to wait on.
+     */
+    void sleep_on(unsigned int value) {
+        if ((value & sleepers) == 0 &&
+            !state.compare_exchange_strong(value, value | sleepers, std::memory_order_relaxed)) {
+            return;
+        }
+        futex(FUTEX_WAIT_PRIVATE, value | sleepers);
+    }
+
+    /**
+     * Lengthens the spin before sleeping when spinning was enough, and shortens it when not.
+     *
+     * @param spinning_paid_off Whether the lock came free before the caller slept.
+     */
+    void adapt_spin_limit(bool spinning_paid_off) {
+        int limit = spin_limit.load(std::memory_order_relaxed);
+        if (spinning_paid_off && limit < max_spins) {
+            spin_limit.store(limit * 2, std::memory_order_relaxed);
+        } else if (!spinning_paid_off && limit > min_spins) {
+            spin_limit.store(limit / 2, std::memory_order_relaxed);
+        }
+    }
+
+    long futex(int operation, unsigned int value) {
+        return syscall(SYS_futex, reinterpret_cast<unsigned int*>(&state), operation, value, NULL, NULL, 0);
+    }
+
+    static const int min_spins = 16;
+    static const int max_spins = 4096;
+
+    std::atomic<unsigned int> state{0}; // Flags and writer count above, plus the readers inside
+    std::atomic<int> spin_limit{256};   // Spins before sleeping; only a hint, so races are harmless
+    static_assert(sizeof(std::atomic<unsigned int>) == 4, "futex() needs a plain 32-bit word");
+};
+
+/**
+ * The C library's pthread_rwlock_t, for comparison.
+ */
+class pthread_rw_lock : public rw_lock {
+public:
+    pthread_rw_lock() { pthread_rwlock_init(&rwlock, NULL); }
+    ~pthread_rw_lock() { pthread_rwlock_destroy(&rwlock); }
+    const char* name() const { return "pthread"; }
+
+    void read_lock() { pthread_rwlock_rdlock(&rwlock); }
+    void read_unlock() { pthread_rwlock_unlock(&rwlock); }
+    void write_lock() { pthread_rwlock_wrlock(&rwlock); }
+    void write_unlock() { pthread_rwlock_unlock(&rwlock); }
+
+private:
+    pthread_rwlock_t rwlock;
+};
+
+/**
+ * Creates a reader-writer lock by name.
+ *
+ * @param name rpref, wpref, fair, phasefair, bravo (BRAVO around rpref), futex or pthread.
+ * @param trace Whether the lock may print its internal state (only rpref does).
+ * @return The lock, or nullptr if the name is unknown.
+ */
+rw_lock* make_rw_lock(const std::string& name, bool trace) {
+    if (name == "rpref") {
+        return new readers_pref_lock(trace);
+    } else if (name == "wpref") {
+        return new writer_pref_lock();
+    } else if (name == "fair") {
+        return new ticket_rw_lock();
+    } else if (name == "phasefair") {
+        return new phase_fair_lock();
+    } else if (name == "bravo") {
+        return new bravo_lock(new readers_pref_lock(trace));
+    } else if (name == "futex") {
+        return new futex_rw_lock();
+    } else if (name == "pthread") {
+        return new pthread_rw_lock();
+    }
+    return nullptr;
+}
+
+/**
+ * The shared string and the way threads get at it. Readers take a consistent copy; writers
+ * apply an edit to it with exclusive access.
+ */
+class shared_text {
+public:
+    virtual ~shared_text() {}
+
+    /**
+     * @return The name used to select the mode on the command line.
+     */
+    virtual const char* name() const = 0;
+
+    /**
+     * Copies the current string.
+     *
+     * @param buffer Receives the string; must hold sizeof(sharedString) bytes.
+     * @return The length of the string.
+     */
+    virtual size_t read(char* buffer) = 0;
+
+    /**
+     * Edits the string in place with no other writer running.
+     *
+     * @param edit Changes the string; it must not make it longer.
+     * @return The length of the string after the edit.
+     */
+    virtual size_t update(void (*edit)(char* text)) = 0;
+};
+
+/**
+ * The original scheme: sharedString itself, guarded by a reader-writer lock.
+ */
+class locked_text : public shared_text {
+public:
+    /**
+     * @param lock The lock; owned.
+     */
+    explicit locked_text(rw_lock* lock) : lock(lock) {}
+    ~locked_text() { delete lock; }
+    const char* name() const { return lock->name(); }
+
+    size_t read(char* buffer) {
+        // Request permission to read
+        lock->read_lock();
+
+        // Read operation
+        size_t length = strlen(sharedString);
+        memcpy(buffer, sharedString, length + 1);
+
+        // Allow writers once no reader is left
+        lock->read_unlock();
+        return length;
+    }
+
+    size_t update(void (*edit)(char* text)) {
+        // Wait for the writer to have exclusive access
+        lock->write_lock();
+
+        // Write operation
+        edit(sharedString);
+        size_t length = strlen(sharedString);
+
+        // Release the writer's exclusive access
+        lock->write_unlock();
+        return length;
+    }
+
+private:
+    rw_lock* lock;
+};
+
+/**
+ * A sequence lock. A writer makes the sequence number odd, changes the string and makes it
+ * even again; a reader copies the string between two reads of the sequence number and retries
+ * if they differ or are odd. Readers never write shared memory, so they do not slow each other
+ * down, but a steady stream of writes can make them retry indefinitely.
+ */
+class seqlock_text : public shared_text {
+public:
+    explicit seqlock_text(const char* initial) {
+        pthread_mutex_init(&writer_mutex, NULL);
+        char text[text_words * 8] = {};
+        strcpy(text, initial);
+        store_words(text);
+    }
+    ~seqlock_text() { pthread_mutex_destroy(&writer_mutex); }
+    const char* name() const { return "seqlock"; }
+
+    size_t read(char* buffer) {
+        // The words are read with relaxed atomics, so a torn copy is discarded, never undefined
+        uint64_t copy[text_words];
+        while (true) {
+            unsigned int before = sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                cpu_relax();
+                continue;
+            }
+            for (int i = 0; i < text_words; i++) {
+                copy[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) {
+                break;
+            }
+        }
+        memcpy(buffer, copy, sizeof(sharedString));
+        buffer[sizeof(sharedString) - 1] = '\0';
+        return strlen(buffer);
+    }
+
+    size_t update(void (*edit)(char* text)) {
+        pthread_mutex_lock(&writer_mutex);
+        char text[text_words * 8];
+        for (int i = 0; i < text_words; i++) {
+            uint64_t word = words[i].load(std::memory_order_relaxed);
+            memcpy(text + i * 8, &word, 8);
+        }
+        edit(text);
+
+        unsigned int start = sequence.load(std::memory_order_relaxed);
+        sequence.store(start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        store_words(text);
+        sequence.store(start + 2, std::memory_order_release);
+        pthread_mutex_unlock(&writer_mutex);
+        return strlen(text);
+    }
+
+private:
+    static const int text_words = (sizeof(sharedString) + 7) / 8;
+
+    void store_words(const char* text) {
+        for (int i = 0; i < text_words; i++) {
+            uint64_t word;
+            memcpy(&word, text + i * 8, 8);
+            words[i].store(word, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<unsigned int> sequence{0}; // Odd while a write is in progress
+    std::atomic<uint64_t> words[text_words];
+    pthread_mutex_t writer_mutex;           // Writers still exclude each other
+};
+
+/**
+ * RCU-style publication with epoch-based reclamation. The string lives in an immutable
+ * version; a writer copies it, edits the copy and publishes it with one atomic pointer store.
+ * A reader announces the global epoch in its own cache line, copies whatever version is
+ * current and goes idle again. An old version is freed once the epoch has advanced twice since
+ * it was replaced, and the epoch only advances when every active reader has seen it, so no
+ * reader can still hold a freed version.
+ */
+class rcu_text : public shared_text {
+public:
+    explicit rcu_text(const char* initial) {
+        pthread_mutex_init(&writer_mutex, NULL);
+        version* first = new version();
+        strcpy(first->text, initial);
+        current.store(first);
+
+        // operator new ignores over-alignment before C++17, so the slots get their own allocation
+        void* memory = nullptr;
+        if (posix_memalign(&memory, 64, sizeof(epoch_slot) * num_slots) != 0) {
+            throw std::bad_alloc();
+        }
+        slots = static_cast<epoch_slot*>(memory);
+        for (int i = 0; i < num_slots; i++) {
+            new (&slots[i]) epoch_slot();
+        }
+    }
+    ~rcu_text() {
+        delete current.load();
+        for (const retired_version& retired : retiredVersions) {
+            delete retired.old;
+        }
+        free(slots);
+        pthread_mutex_destroy(&writer_mutex);
+    }
+    rcu_text(const rcu_text&) = delete;
+    rcu_text& operator=(const rcu_text&) = delete;
+    const char* name() const { return "rcu"; }
+
+    size_t read(char* buffer) {
+        // The announcement must be visible before the pointer is loaded, hence seq_cst on both
+        epoch_slot& slot = reader_slot();
+        slot.epoch.store(global_epoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+        const version* snapshot = current.load(std::memory_order_seq_cst);
+        size_t length = strlen(snapshot->text);
+        memcpy(buffer, snapshot->text, length + 1);
+        slot.epoch.store(idle, std::memory_order_release);
+        return length;
+    }
+
+    size_t update(void (*edit)(char* text)) {
+        pthread_mutex_lock(&writer_mutex);
+        version* old = current.load(std::memory_order_relaxed);
+        version* fresh = new version(*old);
+        edit(fresh->text);
+        size_t length = strlen(fresh->text);
+        current.store(fresh, std::memory_order_seq_cst);
+
+        // Retire the old version in the current epoch, then free what is old enough
+        retiredVersions.push_back(retired_version{old, global_epoch.load(std::memory_order_relaxed)});
+        try_advance_epoch();
+        unsigned long epoch = global_epoch.load(std::memory_order_relaxed);
+        while (!retiredVersions.empty() && retiredVersions.front().epoch + 2 <= epoch) {
+            delete retiredVersions.front().old;
+            retiredVersions.pop_front();
+        }
+        pthread_mutex_unlock(&writer_mutex);
+        return length;
+    }
+
+private:
+    static const int num_slots = 256;
+    static const unsigned long idle = ~0UL;
+
+    struct version {
+        char text[sizeof(sharedString)];
+    };
+
+    struct retired_version {
+        version* old;
+        unsigned long epoch; // The global epoch when it was replaced
+    };
+
+    /**
+     * One reader's announced epoch, alone on its cache line.
+     */
+    struct alignas(64) epoch_slot {
+        std::atomic<unsigned long> epoch{idle};
+        std::atomic<bool> claimed{false};
+    };
+
+    /**
+     * A thread's claim on a slot, given back when the thread exits.
+     */
+    struct slot_claim {
+        const rcu_text* owner = nullptr;
+        epoch_slot* slot = nullptr;
+        ~slot_claim() {
+            if (slot != nullptr) {
+                slot->claimed.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    /**
+     * @return The calling thread's slot, claiming a free one on its first read.
+     */
+    epoch_slot& reader_slot() {
+        static thread_local slot_claim claim;
+        if (claim.owner != this) {
+            claim.owner = this;
+            claim.slot = nullptr;
+            for (int i = 0; i < num_slots && claim.slot == nullptr; i++) {
+                bool unclaimed = false;
+                if (slots[i].claimed.compare_exchange_strong(unclaimed, true)) {
+                    claim.slot = &slots[i];
+                }
+            }
+            if (claim.slot == nullptr) {
+                fprintf(stderr, "rcu: more than %d concurrent readers.\n", num_slots);
+                abort();
+            }
+        }
+        return *claim.slot;
+    }
+
+    /**
+     * Advances the global epoch if every reader inside a read has announced the current one.
+     */
+    void try_advance_epoch() {
+        unsigned long epoch = global_epoch.load(std::memory_order_relaxed);
+        for (int i = 0; i < num_slots; i++) {
+            unsigned long announced = slots[i].epoch.load(std::memory_order_seq_cst);
+            if (announced != idle && announced != epoch) {
+                return;
+            }
+        }
+        global_epoch.store(epoch + 1, std::memory_order_seq_cst);
+    }
+
+    std::atomic<version*> current{nullptr};
+    std::atomic<unsigned long> global_epoch{0};
+    epoch_slot* slots;
+    std::deque<retired_version> retiredVersions; // Oldest first; only touched by writers
+    pthread_mutex_t writer_mutex;
+};
+
+/**
+ * Creates the shared string's access mode by name: a reader-writer lock (see make_rw_lock()),
+ * seqlock or rcu.
+ *
+ * @param name The mode.
+ * @param trace Whether a lock may print its internal state.
+ * @return The mode, or nullptr if the name is unknown.
+ */
+shared_text* make_shared_text(const std::string& name, bool trace) {
+    if (name == "seqlock") {
+        return new seqlock_text(sharedString);
+    } else if (name == "rcu") {
+        return new rcu_text(sharedString);
+    }
+    rw_lock* lock = make_rw_lock(name, trace);
+    return lock != nullptr ? new locked_text(lock) : nullptr;
+}
+
+// The shared string as seen by all reader and writer threads
+shared_text* text = nullptr;
+
+/**
+ * The writers' edit in the simulation: removes the last character.
+ */
+static void remove_last_char(char* text) {
+    size_t length = strlen(text);
+    if (length > 0) {
+        text[length - 1] = '\0';
+    }
+}
+
+/**
+ * The writer's edit in the scaling benchmark: flips the case of the first letter, so the
+ * string never runs out.
+ */
+static void flip_first_case(char* text) {
+    text[0] ^= 0x20;
+}
+
+/**
+ * How long one writer took to update the string, over all its writes.
+ */
+struct writer_wait {
+    long count = 0;      // Number of updates
+    double total_us = 0; // Sum of the update times
+    double max_us = 0;   // Longest update
+};
+
+// One entry per writer thread, indexed by its ID
+writer_wait* writerWaits = nullptr;
+
+/**
+ * Returns the microseconds elapsed since a CLOCK_MONOTONIC timestamp.
+ *
+ * @param start The earlier timestamp.
+ * @return The elapsed time in microseconds.
+ */
+static double elapsed_us(const struct timespec& start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1e6 + (now.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+/**
+ * Simulates a reader thread that reads from a shared resource.
+ *
+ * @param param A pointer to the reader's ID.
+ */
+void *reader(void *param) {
+    int tid = *((int *)param); // Reader ID
+    char content[sizeof(sharedString)];
+
+    while (text->read(content) > 0) {
+        // Read operation
+        printf("reader %d is reading ... content : %s\n", tid, content);
 
         // Sleep for a short period to simulate work
         sleep(1);
@@ -81,21 +976,20 @@ void *reader(void *param) {
  */
 void *writer(void *param) {
     int tid = *((int *)param);
-    while (strlen(sharedString) > 0) {
-        // Wait for the writer to have exclusive access
-        sem_wait(&rw_sem);
-
-        // Write operation
-        if (strlen(sharedString) > 0) {
-            sharedString[strlen(sharedString) - 1] = '\0';
-        }
+    char content[sizeof(sharedString)];
+    while (text->read(content) > 0) {
+        // Remove the last character with exclusive access, timing how long that takes
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t length = text->update(remove_last_char);
+        double wait_us = elapsed_us(start);
+        writerWaits[tid].count++;
+        writerWaits[tid].total_us += wait_us;
+        writerWaits[tid].max_us = std::max(writerWaits[tid].max_us, wait_us);
         printf("writer %d is writing ...\n", tid);
 
-        // Release the writer's exclusive access
-        sem_post(&rw_sem);
-
         // Check if the shared string is empty, and if so, exit
-        if (strlen(sharedString) == 0) {
+        if (length == 0) {
             printf("writer %d is exiting ...\n", tid);
             break;  // Exit the loop
         }
@@ -106,16 +1000,486 @@ void *writer(void *param) {
     pthread_exit(NULL);
 }
 
+// Set by a benchmark's main thread to begin and end a measurement
+std::atomic<bool> benchmarkStart{false};
+std::atomic<bool> benchmarkStop{false};
+
+/**
+ * Holds a benchmark thread until every thread of the measurement has been created and the
+ * main thread sets benchmarkStart, so that all of them start on the same clock.
+ */
+static void wait_for_start() {
+    while (!benchmarkStart.load(std::memory_order_acquire)) {
+        sched_yield();
+    }
+}
+
+/**
+ * One thread's result in the scaling benchmark, alone on its cache line so that counting
+ * does not itself bounce a line between cores.
+ */
+struct alignas(64) reader_result {
+    long reads = 0;
+};
+
+// Results of the scaling benchmark's readers, one per thread; a static array honors the alignment
+reader_result readerResults[64];
+
+// The scaling benchmark writer's update times
+writer_wait benchmarkWriterWait;
+
+/**
+ * A reader in the scaling benchmark: copies the shared string as fast as it can until
+ * benchmarkStop is set.
+ *
+ * @param param A pointer to the reader's reader_result.
+ */
+void *benchmark_reader(void *param) {
+    reader_result* result = (reader_result *)param;
+    long reads = 0;
+    unsigned int checksum = 0;
+    char content[sizeof(sharedString)];
+    wait_for_start();
+    while (!benchmarkStop.load(std::memory_order_relaxed)) {
+        checksum += text->read(content) + content[0];
+        reads++;
+    }
+
+    // Keep the reads from being optimized away
+    if (checksum == 1) {
+        printf("%u\n", checksum);
+    }
+    result->reads = reads;
+    return NULL;
+}
+
+/**
+ * The writer in the scaling benchmark: once a millisecond, flips the case of the shared
+ * string's first letter, so that the string stays read-mostly but writers are never absent.
+ * Times each update into benchmarkWriterWait.
+ *
+ * @param param Unused.
+ */
+void *benchmark_writer(void *param) {
+    wait_for_start();
+    while (!benchmarkStop.load(std::memory_order_relaxed)) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        text->update(flip_first_case);
+        double wait_us = elapsed_us(start);
+        benchmarkWriterWait.count++;
+        benchmarkWriterWait.total_us += wait_us;
+        benchmarkWriterWait.max_us = std::max(benchmarkWriterWait.max_us, wait_us);
+        usleep(1000);
+    }
+    return NULL;
+}
+
+/**
+ * Measures read throughput and writer update time as reader threads are added, 1 to 64, for
+ * each of a list of modes. Usage: z1901330_project4 scale [ms_per_point] [mode,mode,...];
+ * the modes default to rpref (the original semaphore protocol), bravo, seqlock and rcu.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return Exit status of the program.
+ */
+int run_scaling_benchmark(int argc, char *argv[]) {
+    int ms_per_point = argc > 2 ? atoi(argv[2]) : 200;
+    std::string mode_list = argc > 3 ? argv[3] : "rpref,bravo,seqlock,rcu";
+    if (ms_per_point < 1) {
+        fprintf(stderr, "The time per point must be at least 1 ms.\n");
+        return 1;
+    }
+
+    // Check every mode name before measuring anything
+    std::vector<std::string> modeNames;
+    std::stringstream names(mode_list);
+    std::string modeName;
+    while (std::getline(names, modeName, ',')) {
+        shared_text* probe = make_shared_text(modeName, false);
+        if (probe == nullptr) {
+            fprintf(stderr, "Unknown mode: %s\n", modeName.c_str());
+            return 1;
+        }
+        delete probe;
+        modeNames.push_back(modeName);
+    }
+
+    printf("*** Reader Scaling Benchmark ***\n%d ms per point, one writer every 1 ms\n", ms_per_point);
+    printf("%8s", "readers");
+    for (const std::string& name : modeNames) {
+        printf("%18s%11s%11s", (name + " Mreads/s").c_str(), "w_avg_us", "w_max_us");
+    }
+    printf("\n");
+
+    for (int numReaders = 1; numReaders <= 64; numReaders *= 2) {
+        printf("%8d", numReaders);
+        for (const std::string& name : modeNames) {
+            text = make_shared_text(name, false);
+            benchmarkStart.store(false);
+            benchmarkStop.store(false);
+            benchmarkWriterWait = writer_wait();
+
+            reader_result* results = readerResults;
+            std::vector<pthread_t> readerThreads(numReaders);
+            pthread_t writerThread;
+            for (int i = 0; i < numReaders; i++) {
+                pthread_create(&readerThreads[i], NULL, benchmark_reader, &results[i]);
+            }
+            pthread_create(&writerThread, NULL, benchmark_writer, NULL);
+
+            // Release every thread at once and time from there
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            benchmarkStart.store(true, std::memory_order_release);
+            usleep(ms_per_point * 1000);
+            benchmarkStop.store(true);
+            for (int i = 0; i < numReaders; i++) {
+                pthread_join(readerThreads[i], NULL);
+            }
+            pthread_join(writerThread, NULL);
+            double seconds = elapsed_us(start) / 1e6;
+
+            long reads = 0;
+            for (int i = 0; i < numReaders; i++) {
+                reads += results[i].reads;
+            }
+            // A writer that never got to update has no times to report
+            const writer_wait& wait = benchmarkWriterWait;
+            printf("%18.2f", reads / seconds / 1e6);
+            if (wait.count > 0) {
+                printf("%11.1f%11.1f", wait.total_us / wait.count, wait.max_us);
+            } else {
+                printf("%11s%11s", "-", "-");
+            }
+            fflush(stdout);
+
+            delete text;
+            text = nullptr;
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+/**
+ * A log-linear histogram of latencies in nanoseconds: 16 sub-buckets per power of two, so a
+ * percentile is exact to within about 6%. Each thread records into its own, so recording
+ * needs no atomics; the main thread merges them after the threads are joined.
+ */
+struct latency_histogram {
+    static const int sub_buckets = 16;
+    static const int num_buckets = (64 - 4 + 1) * sub_buckets;
+
+    long counts[num_buckets] = {};
+    long total = 0;
+
+    /**
+     * @param ns The latency to record.
+     */
+    void record(uint64_t ns) {
+        counts[bucket(ns)]++;
+        total++;
+    }
+
+    /**
+     * Adds another histogram's counts to this one.
+     */
+    void merge(const latency_histogram& other) {
+        for (int i = 0; i < num_buckets; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+    }
+
+    /**
+     * @param fraction Between 0 and 1, e.g. 0.99.
+     * @return The smallest latency at or above that fraction of the samples, rounded down to
+     *         its bucket; 0 if nothing was recorded.
+     */
+    uint64_t percentile(double fraction) const {
+        long rank = (long)ceil(fraction * total);
+        long seen = 0;
+        for (int i = 0; i < num_buckets; i++) {
+            seen += counts[i];
+            if (seen >= rank && seen > 0) {
+                return lowest(i);
+            }
+        }
+        return 0;
+    }
+
+private:
+    static int bucket(uint64_t ns) {
+        if (ns < sub_buckets) {
+            return (int)ns;
+        }
+        int exponent = 63 - __builtin_clzll(ns); // At least 4
+        int sub = (int)(ns >> (exponent - 4)) & (sub_buckets - 1);
+        return (exponent - 3) * sub_buckets + sub;
+    }
+
+    static uint64_t lowest(int index) {
+        if (index < sub_buckets) {
+            return index;
+        }
+        int exponent = index / sub_buckets + 3;
+        return (uint64_t)(sub_buckets + index % sub_buckets) << (exponent - 4);
+    }
+};
+
+/**
+ * The throughput benchmark's parameters.
+ */
+struct bench_config {
+    int duration_ms = 1000;          // How long each point runs
+    int read_percent = 90;           // Chance that an operation is a read
+    int critical_passes = 1;         // Passes over the string while holding the lock
+    std::vector<int> threadCounts{1, 2, 4, 8};
+    std::vector<std::string> lockNames{"rpref", "wpref", "fair", "phasefair", "bravo", "futex", "pthread"};
+};
+
+/**
+ * One thread's counters and acquire latencies in the throughput benchmark, on cache lines of
+ * its own.
+ */
+struct alignas(64) bench_thread {
+    const bench_config* config;
+    rw_lock* lock;
+    uint64_t seed;
+    long reads = 0;
+    long writes = 0;
+    latency_histogram readAcquire;
+    latency_histogram writeAcquire;
+};
+
+/**
+ * @return The CLOCK_MONOTONIC time in nanoseconds.
+ */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * A thread in the throughput benchmark: from benchmarkStart until benchmarkStop, picks a read or a write at
+ * random, times how long the lock takes to acquire and holds it for the configured number of
+ * passes over the shared string. Nothing is printed until the run is over.
+ *
+ * @param param A pointer to the thread's bench_thread.
+ */
+void *bench_worker(void *param) {
+    bench_thread* self = (bench_thread *)param;
+    const bench_config& config = *self->config;
+    rw_lock* lock = self->lock;
+    uint64_t state = self->seed;
+    unsigned int checksum = 0;
+
+    wait_for_start();
+    while (!benchmarkStop.load(std::memory_order_relaxed)) {
+        // xorshift64: cheap, and private to the thread
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        bool isRead = (int)(state % 100) < config.read_percent;
+
+        uint64_t start = now_ns();
+        if (isRead) {
+            lock->read_lock();
+            self->readAcquire.record(now_ns() - start);
+            for (int pass = 0; pass < config.critical_passes; pass++) {
+                for (const char* c = sharedString; *c != '\0'; c++) {
+                    checksum += *c;
+                }
+            }
+            lock->read_unlock();
+            self->reads++;
+        } else {
+            lock->write_lock();
+            self->writeAcquire.record(now_ns() - start);
+            // A write pass walks the whole string, like a read pass, flipping the case of each letter
+            for (int pass = 0; pass < config.critical_passes; pass++) {
+                for (char* c = sharedString; *c != '\0'; c++) {
+                    if (isalpha((unsigned char)*c)) {
+                        *c ^= 0x20;
+                    }
+                }
+            }
+            lock->write_unlock();
+            self->writes++;
+        }
+    }
+
+    // Keep the reads from being optimized away
+    if (checksum == 1) {
+        printf("%u\n", checksum);
+    }
+    return NULL;
+}
+
+/**
+ * Parses a comma-separated list of thread counts.
+ *
+ * @param list The list, e.g. "1,2,4".
+ * @param counts Receives the counts.
+ * @return Whether every count was a positive number.
+ */
+static bool parse_counts(const std::string& list, std::vector<int>& counts) {
+    counts.clear();
+    std::stringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        int count = atoi(item.c_str());
+        if (count < 1) {
+            return false;
+        }
+        counts.push_back(count);
+    }
+    return !counts.empty();
+}
+
+/**
+ * Measures throughput and acquire latency of the reader-writer locks under a mixed workload
+ * and prints one CSV row per lock and thread count. Usage:
+ * z1901330_project4 bench [-d ms] [-r read_percent] [-c passes] [-t n,n,...] [-l lock,lock,...]
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line argument strings.
+ * @return Exit status of the program.
+ */
+int run_throughput_benchmark(int argc, char *argv[]) {
+    bench_config config;
+    int option;
+    optind = 2;
+    while ((option = getopt(argc, argv, "d:r:c:t:l:")) != -1) {
+        switch (option) {
+            case 'd':
+                config.duration_ms = atoi(optarg);
+                break;
+            case 'r':
+                config.read_percent = atoi(optarg);
+                break;
+            case 'c':
+                config.critical_passes = atoi(optarg);
+                break;
+            case 't':
+                if (!parse_counts(optarg, config.threadCounts)) {
+                    fprintf(stderr, "Invalid thread counts: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l': {
+                config.lockNames.clear();
+                std::stringstream names(optarg);
+                std::string lockName;
+                while (std::getline(names, lockName, ',')) {
+                    config.lockNames.push_back(lockName);
+                }
+                break;
+            }
+            default:
+                fprintf(stderr, "Usage: %s bench [-d ms] [-r read_percent] [-c passes] [-t n,n,...] "
+                        "[-l lock,lock,...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (config.duration_ms < 1 || config.read_percent < 0 || config.read_percent > 100 ||
+        config.critical_passes < 0) {
+        fprintf(stderr, "The duration must be at least 1 ms, the read percentage 0 to 100 and the "
+                "passes at least 0.\n");
+        return 1;
+    }
+    for (const std::string& lockName : config.lockNames) {
+        rw_lock* probe = make_rw_lock(lockName, false);
+        if (probe == nullptr) {
+            fprintf(stderr, "Unknown lock: %s\n", lockName.c_str());
+            return 1;
+        }
+        delete probe;
+    }
+
+    printf("lock,threads,read_percent,critical_passes,duration_s,reads,writes,ops_per_sec,"
+           "read_p50_ns,read_p99_ns,read_p999_ns,write_p50_ns,write_p99_ns,write_p999_ns\n");
+    for (const std::string& lockName : config.lockNames) {
+        for (int numThreads : config.threadCounts) {
+            // operator new ignores over-alignment before C++17, so the threads' state gets its own allocation
+            void* memory = nullptr;
+            if (posix_memalign(&memory, 64, sizeof(bench_thread) * numThreads) != 0) {
+                fprintf(stderr, "Out of memory for %d threads.\n", numThreads);
+                return 1;
+            }
+            bench_thread* threads = static_cast<bench_thread*>(memory);
+            rw_lock* lock = make_rw_lock(lockName, false);
+            benchmarkStart.store(false);
+            benchmarkStop.store(false);
+
+            std::vector<pthread_t> threadIds(numThreads);
+            for (int i = 0; i < numThreads; i++) {
+                new (&threads[i]) bench_thread();
+                threads[i].config = &config;
+                threads[i].lock = lock;
+                threads[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+                pthread_create(&threadIds[i], NULL, bench_worker, &threads[i]);
+            }
+
+            // Release every thread at once and time from there
+            uint64_t start = now_ns();
+            benchmarkStart.store(true, std::memory_order_release);
+            usleep(config.duration_ms * 1000);
+            benchmarkStop.store(true);
+            for (int i = 0; i < numThreads; i++) {
+                pthread_join(threadIds[i], NULL);
+            }
+            double seconds = (now_ns() - start) / 1e9;
+
+            // Merge the per-thread results now that nobody is writing them
+            long reads = 0, writes = 0;
+            latency_histogram readAcquire, writeAcquire;
+            for (int i = 0; i < numThreads; i++) {
+                reads += threads[i].reads;
+                writes += threads[i].writes;
+                readAcquire.merge(threads[i].readAcquire);
+                writeAcquire.merge(threads[i].writeAcquire);
+                threads[i].~bench_thread();
+            }
+            free(threads);
+            delete lock;
+
+            printf("%s,%d,%d,%d,%.3f,%ld,%ld,%.0f,%llu,%llu,%llu,%llu,%llu,%llu\n", lockName.c_str(), numThreads,
+                   config.read_percent, config.critical_passes, seconds, reads, writes, (reads + writes) / seconds,
+                   (unsigned long long)readAcquire.percentile(0.5), (unsigned long long)readAcquire.percentile(0.99),
+                   (unsigned long long)readAcquire.percentile(0.999), (unsigned long long)writeAcquire.percentile(0.5),
+                   (unsigned long long)writeAcquire.percentile(0.99),
+                   (unsigned long long)writeAcquire.percentile(0.999));
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
+
 /**
  * Entry point of the program. Simulates the reader-writer problem
- * with multiple reader and writer threads.
+ * with multiple reader and writer threads. Usage: z1901330_project4 readers writers [lock],
+ * where lock is rpref (the default), wpref, fair, phasefair, bravo, futex or pthread, or one of
+ * the lock-free read modes seqlock and rcu. 'z1901330_project4 scale ...' runs the reader scaling
+ * benchmark and 'z1901330_project4 bench ...' the CSV throughput benchmark instead (see
+ * run_scaling_benchmark() and run_throughput_benchmark()).
  *
  * @param argc Number of command-line arguments.
  * @param argv Array of command-line argument strings.
  * @return Exit status of the program.
  */
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
+    if (argc > 1 && strcmp(argv[1], "scale") == 0) {
+        return run_scaling_benchmark(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return run_throughput_benchmark(argc, argv);
+    }
+
+    if (argc != 3 && argc != 4) {
         fprintf(stderr, "Invalid Arguments\n");
         return 1;
     }
@@ -128,17 +1492,23 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // Select the lock protocol; readers-preference is the original one
+    text = make_shared_text(argc == 4 ? argv[3] : "rpref", true);
+    if (text == nullptr) {
+        fprintf(stderr, "Unknown lock: %s (expected rpref, wpref, fair, phasefair, bravo, futex, pthread, "
+                "seqlock or rcu).\n", argv[3]);
+        return 1;
+    }
+
     printf("*** Reader-Writer Problem Simulation ***\nNumber of reader threads: %d\nNumber of writer threads: %d\n", NUM_READERS, NUM_WRITERS);
+    printf("Lock: %s\n", text->name());
 
     pthread_t* readerThreads = new pthread_t[NUM_READERS];  // Array of reader thread IDs.
     pthread_t* writerThreads = new pthread_t[NUM_WRITERS];  // Array of writer thread IDs.
 
     int* readerThreadIDs = new int[NUM_READERS];  // Array to store reader thread IDs.
     int* writerThreadIDs = new int[NUM_WRITERS];  // Array to store writer thread IDs.
-
-    // Initialize semaphores
-    sem_init(&rw_sem, 0, 1);  // Initialize the read-write semaphore with initial value 1.
-    sem_init(&cs_sem, 0, 1);  // Initialize the critical section semaphore with initial value 1.
+    writerWaits = new writer_wait[NUM_WRITERS];   // Array of each writer's lock wait times.
 
     int i;
 
@@ -164,14 +1534,21 @@ int main(int argc, char *argv[]) {
         pthread_join(writerThreads[i], NULL);
     }
 
+    // Report how long writers took to update the string
+    for (i = 0; i < NUM_WRITERS; i++) {
+        const writer_wait& wait = writerWaits[i];
+        printf("writer %d updated the string %ld times: avg %.1f us, max %.1f us\n", i, wait.count,
+               wait.count > 0 ? wait.total_us / wait.count : 0.0, wait.max_us);
+    }
+
     // Cleanup and exit
-    sem_destroy(&rw_sem);  // Clean up the read-write semaphore.
-    sem_destroy(&cs_sem);  // Clean up the critical section semaphore.
+    delete text;  // Clean up the lock and its semaphores.
 
     delete[] readerThreads;   // Clean up the reader thread IDs array.
     delete[] writerThreads;   // Clean up the writer thread IDs array.
     delete[] readerThreadIDs; // Clean up the reader thread ID array.
     delete[] writerThreadIDs; // Clean up the writer thread ID array.
+    delete[] writerWaits;     // Clean up the writer wait times.
 
     printf("All threads are done.\nResources cleaned up.\n");
 